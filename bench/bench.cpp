@@ -0,0 +1,415 @@
+/*
+ * bench.cpp
+ *
+ *  Micro benchmarks for the yadslib containers against std::set,
+ *  std::unordered_set and a sorted std::vector
+ *  - insert, find, iterate and erase
+ *  - random, sorted and Zipf distributed keys, several sizes
+ *  - the concurrent sets under inserts, erases, lower_bound and scans from 4
+ *    threads at once, every bound and scan is checked to be in order
+ *  - ns per operation, heap bytes per element (every operator new is
+ *    counted) and, on Linux, cache misses per operation from perf events
+ *
+ *  Build and run from the repository root:
+ *  	g++ -std=c++11 -O2 -march=native -Iinclude bench/bench.cpp -o bench_yadslib -pthread
+ *  	./bench_yadslib [max size, default 1000000]
+ *
+ *  Cache misses show as "-" when perf events are not available (not Linux,
+ *  or kernel.perf_event_paranoid too high).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "bounded_set.h"
+#include "bst.h"
+#include "btree.h"
+#include "compact_tree.h"
+#include "concurrent_bst.h"
+#include "flat_set.h"
+#include "frozen_set.h"
+#include "persistent_set.h"
+#include "skip_list.h"
+#include "treap.h"
+
+using namespace yadslib;
+
+/* heap accounting, every allocation carries its size in front */
+
+static std::atomic<std::size_t> live_bytes(0);
+
+void* operator new(std::size_t n) {
+	void* p = std::malloc(n + 16);
+	if (!p)
+		throw std::bad_alloc();
+	*static_cast<std::size_t*>(p) = n;
+	live_bytes.fetch_add(n, std::memory_order_relaxed);
+	return static_cast<char*>(p) + 16;
+}
+
+void operator delete(void* p) noexcept {
+	if (!p)
+		return;
+	char* c = static_cast<char*>(p) - 16;
+	live_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(c), std::memory_order_relaxed);
+	std::free(c);
+}
+
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+
+/* cache misses of the calling thread, -1 when perf events are not there */
+
+class miss_counter {
+public:
+	miss_counter() : fd(-1) {
+#ifdef __linux__
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+	}
+	~miss_counter() {
+#ifdef __linux__
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+	void start() {
+#ifdef __linux__
+		if (fd >= 0) {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+	long long stop() {
+#ifdef __linux__
+		long long count = 0;
+		if (fd >= 0 && ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) == 0 && read(fd, &count, sizeof(count)) == sizeof(count))
+			return count;
+#endif
+		return -1;
+	}
+private:
+	int fd;
+};
+
+static miss_counter misses;
+
+/* keys to insert and keys to look up */
+
+struct workload {
+	const char* name;
+	std::vector<int> keys;
+	std::vector<int> lookups; // about half of them hit
+};
+
+static workload make_random(std::size_t n, std::mt19937& g) {
+	workload w;
+	w.name = "random";
+	for (std::size_t i = 0; i < n; ++i)
+		w.keys.push_back(g() & 0x7fffffff);
+	for (std::size_t i = 0; i < n; ++i)
+		w.lookups.push_back(i % 2 ? w.keys[g() % n] : int(g() & 0x7fffffff));
+	return w;
+}
+
+static workload make_sorted(std::size_t n, std::mt19937& g) {
+	workload w;
+	w.name = "sorted";
+	for (std::size_t i = 0; i < n; ++i)
+		w.keys.push_back(int(2 * i));
+	for (std::size_t i = 0; i < n; ++i)
+		w.lookups.push_back(int(g() % (2 * n)));
+	return w;
+}
+
+// ranks drawn with P(k) ~ 1 / k^0.99, mapped to random values
+static workload make_zipf(std::size_t n, std::mt19937& g) {
+	workload w;
+	w.name = "zipf";
+	std::vector<double> cdf(n);
+	double sum = 0;
+	for (std::size_t k = 0; k < n; ++k)
+		cdf[k] = sum += 1.0 / std::pow(double(k + 1), 0.99);
+	std::vector<int> values(n);
+	for (std::size_t k = 0; k < n; ++k)
+		values[k] = g() & 0x7fffffff;
+	std::uniform_real_distribution<double> u(0, sum);
+	for (std::size_t i = 0; i < 2 * n; ++i) {
+		std::size_t k = std::lower_bound(cdf.begin(), cdf.end(), u(g)) - cdf.begin();
+		(i < n ? w.keys : w.lookups).push_back(values[std::min(k, n - 1)]);
+	}
+	return w;
+}
+
+// few distinct keys, threads keep running into each other
+static workload make_contended(std::size_t n, std::mt19937& g) {
+	workload w;
+	w.name = "shared";
+	for (std::size_t i = 0; i < n; ++i)
+		w.keys.push_back(int(g() % 1024));
+	w.lookups = w.keys;
+	return w;
+}
+
+/* timing and reporting */
+
+static volatile std::size_t sink; // keeps results alive
+
+template <typename _Function>
+static void measure(const char* set, const workload& w, const char* op, std::size_t ops,
+		double bytes_per_key, _Function f) {
+	misses.start();
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	f();
+	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+	long long m = misses.stop();
+	double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / (ops ? ops : 1);
+	char miss[32] = "-";
+	if (m >= 0)
+		std::snprintf(miss, sizeof(miss), "%.2f", double(m) / (ops ? ops : 1));
+	std::printf("%-20s %-7s %9zu %-8s %10.1f %10.1f %10s\n", set, w.name, w.keys.size(), op, ns, bytes_per_key, miss);
+}
+
+/* any container with insert, count, erase and forward iteration, args go
+ to its constructor */
+template <typename _Set, typename... _Args>
+static void bench_set(const char* name, const workload& w, _Args... args) {
+	std::size_t before = live_bytes;
+	_Set* s = new _Set(args...);
+	double bytes = 0;
+	measure(name, w, "insert", w.keys.size(), bytes, [&] {
+		for (std::size_t i = 0; i < w.keys.size(); ++i)
+			s->insert(w.keys[i]);
+	});
+	bytes = double(live_bytes - before) / (s->size() ? s->size() : 1);
+	measure(name, w, "find", w.lookups.size(), bytes, [&] {
+		std::size_t hits = 0;
+		for (std::size_t i = 0; i < w.lookups.size(); ++i)
+			hits += s->count(w.lookups[i]);
+		sink = hits;
+	});
+	measure(name, w, "iterate", s->size(), bytes, [&] {
+		std::size_t sum = 0;
+		for (typename _Set::iterator it = s->begin(); it != s->end(); ++it)
+			sum += *it;
+		sink = sum;
+	});
+	measure(name, w, "erase", w.keys.size(), bytes, [&] {
+		for (std::size_t i = 0; i < w.keys.size(); ++i)
+			s->erase(w.keys[i]);
+	});
+	delete s;
+}
+
+static void out_of_order(const char* name, const char* what, int x, int y) {
+	std::fprintf(stderr, "%s: %s %d then %d, out of order\n", name, what, x, y);
+	std::abort();
+}
+
+/* each thread inserts, erases, looks up lower bounds and now and then scans the
+ whole set, all on the same few keys. A bound less than its key or a scan
+ that does not ascend aborts the run. Scans step with upper bounds */
+template <typename _Set>
+static void bench_concurrent(const char* name, const workload& w) {
+	static const std::size_t threads = 4;
+	_Set s;
+	measure(name, w, "mixed", threads * w.keys.size(), 0, [&] {
+		std::vector<std::thread> pool;
+		for (std::size_t t = 0; t < threads; ++t) {
+			pool.push_back(std::thread([&s, &w, name, t] {
+				std::size_t n = w.keys.size();
+				std::size_t hits = 0;
+				for (std::size_t i = 0; i < n; ++i) {
+					int x = w.keys[(i + t * n / threads) % n];
+					switch ((i + t) % 4) {
+					case 0:
+						s.insert(x);
+						break;
+					case 1:
+						s.erase(x);
+						break;
+					case 2: {
+						typename _Set::iterator it = s.lower_bound(x);
+						if (it != s.end() && *it < x)
+							out_of_order(name, "lower_bound", x, *it);
+						hits += it != s.end() && *it == x;
+						break;
+					}
+					default:
+						if (i % 1024 == 3) {
+							typename _Set::iterator it = s.begin();
+							if (it == s.end())
+								break;
+							for (int prev = *it; ++it != s.end(); prev = *it) {
+								if (!(prev < *it))
+									out_of_order(name, "scan", prev, *it);
+							}
+						}
+					}
+				}
+				sink = hits;
+			}));
+		}
+		for (std::size_t t = 0; t < threads; ++t)
+			pool[t].join();
+	});
+}
+
+// iterates a snapshot, the set itself has no iterators
+static void bench_persistent_set(const workload& w) {
+	std::size_t before = live_bytes;
+	persistent_set<int>* s = new persistent_set<int>();
+	double bytes = 0;
+	measure("persistent_set", w, "insert", w.keys.size(), bytes, [&] {
+		for (std::size_t i = 0; i < w.keys.size(); ++i)
+			s->insert(w.keys[i]);
+	});
+	bytes = double(live_bytes - before) / (s->size() ? s->size() : 1);
+	measure("persistent_set", w, "find", w.lookups.size(), bytes, [&] {
+		std::size_t hits = 0;
+		for (std::size_t i = 0; i < w.lookups.size(); ++i)
+			hits += s->count(w.lookups[i]);
+		sink = hits;
+	});
+	measure("persistent_set", w, "iterate", s->size(), bytes, [&] {
+		persistent_set<int>::snapshot snap = s->current();
+		std::size_t sum = 0;
+		for (persistent_set<int>::iterator it = snap.begin(); it != snap.end(); ++it)
+			sum += *it;
+		sink = sum;
+	});
+	measure("persistent_set", w, "erase", w.keys.size(), bytes, [&] {
+		for (std::size_t i = 0; i < w.keys.size(); ++i)
+			s->erase(w.keys[i]);
+	});
+	delete s;
+}
+
+// sorted, deduplicated copy of the keys
+static std::vector<int> sorted_keys(const workload& w) {
+	std::vector<int> v(w.keys);
+	std::sort(v.begin(), v.end());
+	v.erase(std::unique(v.begin(), v.end()), v.end());
+	return v;
+}
+
+// built once: insert means the whole build, there is no erase
+static void bench_sorted_vector(const workload& w) {
+	std::size_t before = live_bytes;
+	std::vector<int> v;
+	measure("sorted vector", w, "build", w.keys.size(), 0, [&] { v = sorted_keys(w); });
+	double bytes = double(live_bytes - before) / (v.size() ? v.size() : 1);
+	measure("sorted vector", w, "find", w.lookups.size(), bytes, [&] {
+		std::size_t hits = 0;
+		for (std::size_t i = 0; i < w.lookups.size(); ++i)
+			hits += std::binary_search(v.begin(), v.end(), w.lookups[i]);
+		sink = hits;
+	});
+	measure("sorted vector", w, "iterate", v.size(), bytes, [&] {
+		std::size_t sum = 0;
+		for (std::size_t i = 0; i < v.size(); ++i)
+			sum += v[i];
+		sink = sum;
+	});
+}
+
+static void bench_frozen_set(const workload& w) {
+	std::vector<int> v = sorted_keys(w);
+	std::size_t before = live_bytes;
+	frozen_set<int>* f = NULL;
+	measure("frozen_set", w, "build", w.keys.size(), 0, [&] {
+		f = new frozen_set<int>(sorted_unique, v.begin(), v.end());
+	});
+	double bytes = double(live_bytes - before) / (f->size() ? f->size() : 1);
+	measure("frozen_set", w, "find", w.lookups.size(), bytes, [&] {
+		std::size_t hits = 0;
+		for (std::size_t i = 0; i < w.lookups.size(); ++i)
+			hits += f->count(w.lookups[i]);
+		sink = hits;
+	});
+	std::vector<std::size_t> out(w.lookups.size());
+	measure("frozen_set", w, "find_bat", w.lookups.size(), bytes, [&] {
+		f->count_batch(w.lookups.begin(), w.lookups.end(), out.begin());
+	});
+	measure("frozen_set", w, "iterate", f->size(), bytes, [&] {
+		std::size_t sum = 0;
+		for (frozen_set<int>::iterator it = f->begin(); it != f->end(); ++it)
+			sum += *it;
+		sink = sum;
+	});
+	delete f;
+}
+
+typedef binary_search_tree<int> bst_plain;
+typedef binary_search_tree<int, std::less<int>, std::allocator<int>, avl_balance> bst_avl;
+typedef binary_search_tree<int, std::less<int>, std::allocator<int>, rb_balance> bst_rb;
+typedef binary_search_tree<int, std::less<int>, pool_allocator<int>, rb_balance> bst_rb_pool;
+
+int main(int argc, char** argv) {
+	std::size_t max_size = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+	std::mt19937 g(42);
+	std::printf("%-20s %-7s %9s %-8s %10s %10s %10s\n", "set", "keys", "n", "op", "ns/op", "bytes/key", "misses/op");
+	for (std::size_t n = 1000; n <= max_size; n *= 10) {
+		workload loads[] = { make_random(n, g), make_sorted(n, g), make_zipf(n, g) };
+		for (std::size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); ++i) {
+			const workload& w = loads[i];
+			bench_set<std::set<int> >("std::set", w);
+			bench_set<std::unordered_set<int> >("std::unordered_set", w);
+			bench_sorted_vector(w);
+			// no balancing degenerates into a list on sorted keys
+			if (std::string(w.name) != "sorted" || n <= 10000)
+				bench_set<bst_plain>("bst", w);
+			bench_set<bst_avl>("bst avl", w);
+			bench_set<bst_rb>("bst rb", w);
+			bench_set<bst_rb_pool>("bst rb pool", w);
+			bench_set<compact_tree<int> >("compact_tree", w);
+			bench_set<b_plus_tree<int> >("b_plus_tree", w);
+			bench_set<treap<int> >("treap", w);
+			bench_set<skip_list<int> >("skip_list", w);
+			// unbalanced like bst
+			if (std::string(w.name) != "sorted" || n <= 10000)
+				bench_set<concurrent_bst<int> >("concurrent_bst", w);
+			bench_persistent_set(w);
+			// inserts merge O(n) keys every 32, erases move O(n) keys
+			if (n <= 100000)
+				bench_set<flat_set<int> >("flat_set", w);
+			// the n / 8 greatest keys, the others are turned away or evicted
+			bench_set<bounded_set<int, evict_min> >("bounded_set min", w, n / 8);
+			// erase takes O(capacity) with evict_oldest
+			if (n <= 10000)
+				bench_set<bounded_set<int, evict_oldest> >("bounded_set oldest", w, n / 8);
+			bench_frozen_set(w);
+		}
+		workload shared = make_contended(n, g);
+		bench_concurrent<skip_list<int> >("skip_list", shared);
+		bench_concurrent<concurrent_bst<int> >("concurrent_bst", shared);
+	}
+	return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * block_search.h
+ *
+ *  Rank of a key inside a small sorted block, without branches
+ *  - count_less(p, n, x): how many of the n sorted keys at p are less than x
+ *  - count_not_greater(p, n, x): how many are not greater than x
+ *
+ *  Both just add up comparisons over the whole block, the block being sorted
+ *  that is also the position of the first key that fails. With std::less on
+ *  4 and 8 byte integers a 64 byte block is compared at once with SSE2 /
+ *  SSE4.2 / AVX2, whichever the compiler targets. The vector kernels read
+ *  all 64 bytes, the block has to be that large even when n is smaller.
+ */
+
+#ifndef BLOCK_SEARCH_H_
+#define BLOCK_SEARCH_H_
+
+#include <cstddef>
+#include <functional>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace yadslib {
+namespace detail {
+
+inline unsigned popcount(unsigned x) {
+#if defined(__GNUC__)
+	return __builtin_popcount(x);
+#else
+	unsigned c = 0;
+	for (; x; x &= x - 1)
+		++c;
+	return c;
+#endif
+}
+
+// bit i set for i < n
+inline unsigned low_bits(std::size_t n) { return n >= 32 ? ~0u : (1u << n) - 1; }
+
+/* 64 bytes of integers against x. less() sets bit i when p[i] < x,
+ greater() when p[i] > x. Only defined where we have vector compares */
+template <std::size_t _Size, bool _Signed>
+struct simd_block {
+	static const bool enabled = false;
+};
+
+#if defined(__SSE2__)
+template <bool _Signed>
+struct simd_block<4, _Signed> {
+	static const bool enabled = true;
+	// unsigned keys compare as signed once the top bit is flipped
+	static __m128i bias() { return _mm_set1_epi32(_Signed ? 0 : static_cast<int>(0x80000000u)); }
+
+	template <typename _Int>
+	static unsigned less(const _Int* p, _Int x) {
+		__m128i b = bias();
+		__m128i vx = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(x)), b);
+		unsigned mask = 0;
+		for (int i = 0; i < 4; ++i) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i), b);
+			mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, vx))) << (4 * i);
+		}
+		return mask;
+	}
+
+	template <typename _Int>
+	static unsigned greater(const _Int* p, _Int x) {
+		__m128i b = bias();
+		__m128i vx = _mm_xor_si128(_mm_set1_epi32(static_cast<int>(x)), b);
+		unsigned mask = 0;
+		for (int i = 0; i < 4; ++i) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i), b);
+			mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, vx))) << (4 * i);
+		}
+		return mask;
+	}
+};
+#endif
+
+#if defined(__AVX2__)
+template <bool _Signed>
+struct simd_block<8, _Signed> {
+	static const bool enabled = true;
+	static __m256i bias() { return _mm256_set1_epi64x(_Signed ? 0 : static_cast<long long>(0x8000000000000000ull)); }
+
+	template <typename _Int>
+	static unsigned less(const _Int* p, _Int x) {
+		__m256i b = bias();
+		__m256i vx = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(x)), b);
+		__m256i v0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), b);
+		__m256i v1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p) + 1), b);
+		return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vx, v0)))
+			| _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(vx, v1))) << 4;
+	}
+
+	template <typename _Int>
+	static unsigned greater(const _Int* p, _Int x) {
+		__m256i b = bias();
+		__m256i vx = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(x)), b);
+		__m256i v0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), b);
+		__m256i v1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p) + 1), b);
+		return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v0, vx)))
+			| _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v1, vx))) << 4;
+	}
+};
+#elif defined(__SSE4_2__)
+template <bool _Signed>
+struct simd_block<8, _Signed> {
+	static const bool enabled = true;
+	static __m128i bias() { return _mm_set1_epi64x(_Signed ? 0 : static_cast<long long>(0x8000000000000000ull)); }
+
+	template <typename _Int>
+	static unsigned less(const _Int* p, _Int x) {
+		__m128i b = bias();
+		__m128i vx = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(x)), b);
+		unsigned mask = 0;
+		for (int i = 0; i < 4; ++i) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i), b);
+			mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(vx, v))) << (2 * i);
+		}
+		return mask;
+	}
+
+	template <typename _Int>
+	static unsigned greater(const _Int* p, _Int x) {
+		__m128i b = bias();
+		__m128i vx = _mm_xor_si128(_mm_set1_epi64x(static_cast<long long>(x)), b);
+		unsigned mask = 0;
+		for (int i = 0; i < 4; ++i) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p) + i), b);
+			mask |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v, vx))) << (2 * i);
+		}
+		return mask;
+	}
+};
+#endif
+
+// any key and comparator, one comparison per key and no early exit
+template <typename _Key, typename _Compare, bool _Simd = false>
+struct block_rank {
+	static std::size_t count_less(const _Key* p, std::size_t n, const _Key& x, const _Compare& comp) {
+		std::size_t c = 0;
+		for (std::size_t i = 0; i < n; ++i)
+			c += comp(p[i], x);
+		return c;
+	}
+
+	static std::size_t count_not_greater(const _Key* p, std::size_t n, const _Key& x, const _Compare& comp) {
+		std::size_t c = 0;
+		for (std::size_t i = 0; i < n; ++i)
+			c += !comp(x, p[i]);
+		return c;
+	}
+};
+
+template <typename _Key, typename _Compare>
+struct block_rank<_Key, _Compare, true> {
+	typedef simd_block<sizeof(_Key), std::numeric_limits<_Key>::is_signed> kernel;
+
+	static std::size_t count_less(const _Key* p, std::size_t n, const _Key& x, const _Compare&) {
+		return popcount(kernel::less(p, x) & low_bits(n));
+	}
+
+	static std::size_t count_not_greater(const _Key* p, std::size_t n, const _Key& x, const _Compare&) {
+		return n - popcount(kernel::greater(p, x) & low_bits(n));
+	}
+};
+
+// true for std::less on integers we have a kernel for
+template <typename _Key, typename _Compare>
+struct use_simd_block {
+	static const bool value = false;
+};
+
+template <typename _Key>
+struct use_simd_block<_Key, std::less<_Key> > {
+	static const bool value = std::numeric_limits<_Key>::is_integer
+		&& simd_block<sizeof(_Key), std::numeric_limits<_Key>::is_signed>::enabled;
+};
+
+template <typename _Key, typename _Compare>
+inline std::size_t count_less(const _Key* p, std::size_t n, const _Key& x, const _Compare& comp) {
+	return block_rank<_Key, _Compare, use_simd_block<_Key, _Compare>::value>::count_less(p, n, x, comp);
+}
+
+template <typename _Key, typename _Compare>
+inline std::size_t count_not_greater(const _Key* p, std::size_t n, const _Key& x, const _Compare& comp) {
+	return block_rank<_Key, _Compare, use_simd_block<_Key, _Compare>::value>::count_not_greater(p, n, x, comp);
+}
+
+}; // namespace detail
+}; // namespace
+
+#endif /* BLOCK_SEARCH_H_ */
@@ -0,0 +1,227 @@
+/*
+ * bounded_set.h
+ *
+ *  Ordered set with a capacity (C++11), for "top k" and "latest n" sets fed
+ *  by a stream of keys. A binary_search_tree underneath, with
+ *  - insert() that evicts a key once the set is full, in one operation
+ *  - eviction policies: evict_min keeps the k greatest keys, evict_max the
+ *    k least, evict_oldest the last k keys inserted
+ *  - the evicted node is reused for the new key (see extract() and
+ *    insert(node_type)), a full set touches its allocator no more
+ *  - the read interface of binary_search_tree, keys in order
+ *
+ *  With evict_min a key not greater than min() is turned away once the set
+ *  is full, it would be the one to go (evict_max likewise). Inserting a
+ *  key that is there already changes nothing, it does not count as new for
+ *  evict_oldest either. evict_oldest keeps the insertion order in a ring
+ *  of capacity iterators, erase() then takes O(capacity).
+ *
+ *  Balanced with red-black trees by default, evicting min() or max() over
+ *  and over would leave an unbalanced tree a list.
+ */
+
+#ifndef BOUNDED_SET_H_
+#define BOUNDED_SET_H_
+
+#if __cplusplus < 201103L
+#error "bounded_set.h needs C++11 node handles"
+#endif
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bst.h"
+
+namespace yadslib {
+
+// eviction policies
+struct evict_min { };
+struct evict_max { };
+struct evict_oldest { };
+
+template <typename _Key, typename _Evict = evict_min, typename _Compare = std::less<_Key>,
+	typename _Alloc = std::allocator<_Key>, typename _Balance = rb_balance>
+class bounded_set {
+	typedef binary_search_tree<_Key, _Compare, _Alloc, _Balance> tree_type;
+
+public:
+	typedef typename tree_type::allocator_type allocator_type;
+	typedef typename tree_type::value_type value_type;
+	typedef typename tree_type::reference reference;
+	typedef typename tree_type::const_reference const_reference;
+	typedef typename tree_type::size_type size_type;
+	typedef typename tree_type::key_type key_type;
+	typedef typename tree_type::key_compare key_compare;
+	typedef _Evict eviction_policy;
+
+	typedef typename tree_type::iterator iterator;
+	typedef typename tree_type::const_iterator const_iterator;
+	typedef typename tree_type::reverse_iterator reverse_iterator;
+	typedef typename tree_type::const_reverse_iterator const_reverse_iterator;
+
+	explicit bounded_set(size_t capacity, const _Compare& comp = _Compare())
+		: tree(comp), m_capacity(capacity), oldest(0) {
+		if (keeps_order)
+			ring.resize(capacity);
+	}
+
+	// the ring is rebuilt, its iterators must point into the copy, O(k log k)
+	bounded_set(const bounded_set& other)
+		: tree(other.tree), m_capacity(other.m_capacity), oldest(0) {
+		if (keeps_order) {
+			ring.resize(m_capacity);
+			for (size_t i = 0; i < tree.size(); ++i)
+				ring[i] = tree.find(*other.ring[(other.oldest + i) % m_capacity]);
+		}
+	}
+
+	bounded_set& operator=(const bounded_set& other) {
+		if (this != &other) {
+			bounded_set tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+	// the nodes go along with the tree, the ring stays valid. Both moves leave other empty with capacity 0
+	bounded_set(bounded_set&& other)
+		: tree(other.tree.key_comp()), m_capacity(0), oldest(0) {
+		swap(other);
+	}
+
+	bounded_set& operator=(bounded_set&& other) {
+		if (this != &other) {
+			bounded_set tmp(std::move(other));
+			swap(tmp);
+		}
+		return *this;
+	}
+
+	void swap(bounded_set& other) {
+		using std::swap;
+		tree.swap(other.tree);
+		swap(m_capacity, other.m_capacity);
+		ring.swap(other.ring);
+		swap(oldest, other.oldest);
+	}
+
+	size_t capacity() const { return m_capacity; }
+	size_t size() const { return tree.size(); }
+	bool empty() const { return tree.empty(); }
+	bool full() const { return tree.size() == m_capacity; }
+	key_compare key_comp() const { return tree.key_comp(); }
+
+	void clear() {
+		tree.clear();
+		oldest = 0;
+	}
+
+	/* true if x went in, false if it was there or turned away (end() then).
+	 A full set evicts a key for it first */
+	std::pair<iterator, bool> insert(const_reference x) { return insert_key(_Key(x)); }
+	std::pair<iterator, bool> insert(value_type&& x) { return insert_key(std::move(x)); }
+
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_t erase(const_reference x) {
+		iterator it = tree.find(x);
+		if (it == tree.end())
+			return 0;
+		if (keeps_order)
+			forget(it);
+		tree.extract(it); // the handle frees the node
+		return 1;
+	}
+
+	size_t count(const_reference x) const { return tree.count(x); }
+	iterator find(const_reference x) const { return tree.find(x); }
+	iterator lower_bound(const_reference x) const { return tree.lower_bound(x); }
+	iterator upper_bound(const_reference x) const { return tree.upper_bound(x); }
+	std::pair<iterator, iterator> equal_range(const_reference x) const { return tree.equal_range(x); }
+
+	iterator begin() const { return tree.begin(); }
+	iterator end() const { return tree.end(); }
+	reverse_iterator rbegin() const { return tree.rbegin(); }
+	reverse_iterator rend() const { return tree.rend(); }
+
+	const_reference min() const { return tree.min(); }
+	const_reference max() const { return tree.max(); }
+
+private:
+	static const bool keeps_order = std::is_same<_Evict, evict_oldest>::value;
+
+	tree_type tree;
+	size_t m_capacity;
+	std::vector<iterator> ring; // evict_oldest: size() keys in insertion order from oldest on
+	size_t oldest;
+
+	std::pair<iterator, bool> insert_key(_Key&& x) {
+		if (tree.size() < m_capacity) {
+			std::pair<iterator, bool> r = tree.insert(std::move(x));
+			if (r.second && keeps_order)
+				ring[(oldest + tree.size() - 1) % m_capacity] = r.first;
+			return r;
+		}
+		if (m_capacity == 0)
+			return std::make_pair(tree.end(), false);
+		iterator victim = victim_of(_Evict());
+		if (!evicts_for(*victim, x, _Evict()))
+			return std::make_pair(equal(*victim, x) ? victim : tree.end(), false);
+		// the victim's node takes x, x takes the victim's key
+		typename tree_type::node_type nh = tree.extract(victim);
+		std::swap(nh.value(), x);
+		typename tree_type::insert_return_type r = tree.insert(std::move(nh));
+		if (!r.inserted) {
+			// x was there already, the victim goes back
+			std::swap(r.node.value(), x);
+			tree.insert(std::move(r.node));
+			return std::make_pair(r.position, false);
+		}
+		if (keeps_order) {
+			ring[oldest] = r.position; // same node
+			oldest = (oldest + 1) % m_capacity;
+		}
+		return std::make_pair(r.position, true);
+	}
+
+	iterator victim_of(evict_min) const { return tree.begin(); }
+	iterator victim_of(evict_max) const { return --tree.end(); }
+	iterator victim_of(evict_oldest) const { return ring[oldest]; }
+
+	// does x take the place of victim
+	bool evicts_for(const _Key& victim, const _Key& x, evict_min) const { return tree.key_comp()(victim, x); }
+	bool evicts_for(const _Key& victim, const _Key& x, evict_max) const { return tree.key_comp()(x, victim); }
+	bool evicts_for(const _Key& victim, const _Key& x, evict_oldest) const { return !equal(victim, x); }
+
+	bool equal(const _Key& a, const _Key& b) const {
+		return !tree.key_comp()(a, b) && !tree.key_comp()(b, a);
+	}
+
+	// drop it from the ring, the younger keys move up one slot
+	void forget(iterator it) {
+		size_t n = tree.size();
+		size_t i = 0;
+		while (ring[(oldest + i) % m_capacity] != it)
+			++i;
+		for (; i + 1 < n; ++i)
+			ring[(oldest + i) % m_capacity] = ring[(oldest + i + 1) % m_capacity];
+	}
+};
+
+template <typename _Key, typename _Evict, typename _Compare, typename _Alloc, typename _Balance>
+inline void swap(bounded_set<_Key, _Evict, _Compare, _Alloc, _Balance>& a,
+		bounded_set<_Key, _Evict, _Compare, _Alloc, _Balance>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* BOUNDED_SET_H_ */
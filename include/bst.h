@@ -5,8 +5,31 @@
  *      Author: Daniel Tralamazza
  *
  *  Binary Search Tree with
- *  - parent pointers
+ *  - parent pointers and a header node (end()), like libstdc++'s _Rb_tree
+ *  - bidirectional iterators, O(1) begin(), --end(), min() and max()
  *  - no duplicates (acts like a set)
+ *  - pluggable comparator, one comparison per visited node
+ *  - lean layout for scalar keys: branch free descents that load both kids
+ *    ahead, the key packed next to the balancing data when that shrinks the
+ *    node, and trivially copyable nodes copied and freed in blocks
+ *  - keys constructed in place, move and emplace with C++11
+ *  - hinted insert, O(1) amortized when the key belongs next to the hint,
+ *    and append_max() for increasing keys
+ *  - optional self balancing (see bst_balance.h)
+ *  - O(chunks) clear() when used with pool_allocator
+ *  - O(N) balanced construction from sorted ranges
+ *  - compact(): moves every node into one block in van Emde Boas order
+ *  - serialize() / deserialize(): binary snapshots of trivially copyable
+ *    keys, restored with one allocation and the O(N) sorted build
+ *  - lower_bound / upper_bound / equal_range and O(log n + k) range scans
+ *  - batched lookups that overlap their cache misses
+ *  - split_ranges() into ordered parts of about equal size and, with C++11,
+ *    parallel_for_each() over them
+ *  - extract() / insert(node_type) and merge(), nodes move between trees
+ *    without reallocation or key copies
+ *  - optional subtree augmentation, rank() and select() (see bst_augment.h)
+ *  - optional comparison, rotation and allocation counters (see bst_stats.h),
+ *    height(), depth histogram and average path length
  */
 
 #ifndef BST_H_
@@ -15,29 +38,87 @@
 #include <iostream>
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <future>
+#include <thread>
+#endif
+
+#include "bst_augment.h"
+#include "bst_balance.h"
+#include "bst_stats.h"
+#include "pool_allocator.h"
+#include "traits.h"
 
 namespace yadslib {
 
-template <typename _Key, typename _Alloc = std::allocator<_Key> >
+namespace detail {
+
+// a node's key, or nothing when it is stored elsewhere in the node
+template <typename _Key, bool _Here>
+struct key_member { _Key data; };
+
+template <typename _Key>
+struct key_member<_Key, false> { };
+
+}; // namespace detail
+
+// what serialize() writes first, the keys follow in order
+struct bst_header {
+	char magic[8]; // "yadsbst"
+	uint32_t version;
+	uint32_t byte_order; // 0x01020304 as written
+	uint32_t key_size;
+	uint32_t reserved;
+	uint64_t count;
+};
+
+template <typename _Key, typename _Compare = std::less<_Key>,
+	typename _Alloc = std::allocator<_Key>, typename _Balance = no_balance,
+	typename _Augment = no_augment, typename _Stats = no_stats>
 class binary_search_tree {
 private:
-	// trivial node class
-	struct node {
-		typedef node* pointer;
-		typedef node& reference;
-		typedef const reference const_reference;
+	// node layouts without and with the key next to the balancing data
+	struct plain_layout_base : _Balance::node_data, _Augment::template node_data<_Key> { void* links[3]; };
+	struct plain_layout : plain_layout_base { _Key data; };
+	struct packed_layout : _Balance::node_data, _Augment::template node_data<_Key>,
+		detail::key_member<_Key, true> { void* links[3]; };
+
+	/* a scalar key goes in front of the links if that shrinks the node,
+	 an int with AVL or red-black balancing fills the padding after the
+	 height or color: 32 bytes instead of 40. The header gets a key too,
+	 never used */
+	static const bool packed_key = detail::is_scalar<_Key>::value
+		&& sizeof(packed_layout) < sizeof(plain_layout);
+
+	/* descents take edge[comparison] for cheap keys, see
+	 detail::has_cheap_compare. Without a branch to predict the next node is
+	 not loaded ahead, so they fetch both kids while comparing */
+	static const bool branchless = detail::has_cheap_compare<_Key, _Compare>::value;
+
+	/* links and balancing data of a node. The tree's header is one too, it
+	 is the only one without a parent, its left edge is the root and its
+	 right edge the right most node, the root's parent is the header. end()
+	 points to the header so end() - 1 is O(1) and in order walks need no
+	 special cases (the root is its parent's left kid) */
+	struct node_base : _Balance::node_data, _Augment::template node_data<_Key>,
+			detail::key_member<_Key, packed_key> {
+		typedef node_base* pointer;
 
-		_Key data;
 		pointer parent;
 		pointer edge[2]; // 0 -> left, 1 -> right
 		pointer left() const { return edge[0]; }
 		void left(pointer n) { edge[0] = n; }
 		pointer right() const { return edge[1]; }
-		bool operator==(const_reference other) const { return data == other.data; }
-		bool operator!=(const_reference other) const { return data != other.data; }
-		bool operator<(const_reference other) const { return data < other.data; }
 		static pointer left_most(pointer pnode) {
 			while (pnode->left())
 				pnode = pnode->left();
@@ -50,38 +131,62 @@ private:
 		}
 	};
 
+	// trivial node class, balancing and augmented data come from the policies
+	struct node : node_base, detail::key_member<_Key, !packed_key> { };
+
+	// nodes, key included, that can be copied as bytes
+	static const bool trivial_nodes = detail::is_trivially_copyable<node>::value;
+
+	typedef node_base* base_ptr;
+
+	// rebind to allocate nodes instead of _Key
+	typedef typename _Alloc::template rebind<node>::other node_allocator;
+
+	static const _Key& key(const node_base* pnode) { return static_cast<const node*>(pnode)->data; }
+
 	// in order tree traversal
 	class inorder_traversal {
 	private:
-		node* io_node;
+		base_ptr io_node;
 
 	protected:
-		inorder_traversal(node* _node, bool _from_start) : io_node(_node) {
-			if (io_node && _from_start) {
-				io_node = node::left_most(io_node);
-			}
-		}
+		inorder_traversal(base_ptr _node) : io_node(_node) { }
 
-		node* current() const { return io_node; }
+		base_ptr current() const { return io_node; }
 
-		node* successor() {
-			if (io_node == NULL)
-				return NULL; // trivial case
+		base_ptr successor() {
+			if (io_node->parent == NULL)
+				return io_node; // trivial case, end() stays put
 			if (io_node->right()) {
 				// node has a right kid
-				io_node = node::left_most(io_node->right()); // go down right and
+				io_node = node_base::left_most(io_node->right()); // go down right and
 				return io_node; // get the left most
 			} else { // right kid is null
-				// while io_node is not root and is different from its parent left edge
-				while ( io_node->parent != NULL && (io_node != io_node->parent->left()) ) {
+				// while io_node is different from its parent left edge (the root is the header's left)
+				while (io_node != io_node->parent->left())
 					io_node = io_node->parent; // go up
-				}
 				io_node = io_node->parent;
 				return io_node;
 			}
 		}
 
-		node* predecessor() { return NULL; } // TODO for bidirectional iterator
+		base_ptr predecessor() {
+			if (io_node->parent == NULL) {
+				io_node = io_node->right(); // end() - 1, the header caches the right most
+				return io_node;
+			}
+			if (io_node->left()) {
+				// node has a left kid
+				io_node = node_base::right_most(io_node->left()); // go down left and
+				return io_node; // get the right most
+			} else {
+				// while io_node is its parent left edge and not the root, go up
+				while (io_node->parent->parent && io_node == io_node->parent->left())
+					io_node = io_node->parent;
+				io_node = io_node->parent;
+				return io_node;
+			}
+		}
 	};
 
 public:
@@ -92,112 +197,373 @@ public:
 	typedef typename _Alloc::pointer pointer;
 	typedef typename _Alloc::const_pointer const_pointer;
 	typedef typename _Alloc::size_type size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
 
-
+	// keys are const, changing one in place would break the ordering
 	template <class TraversalPolicy>
-	class node_iterator : public TraversalPolicy, std::iterator<std::forward_iterator_tag, _Key> {
+	class node_iterator : public TraversalPolicy {
 	public:
-		//node_iterator(const node_iterator& _it) : TraversalPolicy(_it.pnode, false), pnode(_it.pnode) {	}
-		node_iterator(node* _node, bool _from_start) : TraversalPolicy(_node, _from_start) {
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		node_iterator() : TraversalPolicy(NULL), pnode(NULL) { }
+		explicit node_iterator(base_ptr _node) : TraversalPolicy(_node) {
 			pnode = this->current();
 		}
-		bool operator==(const node_iterator& other) {
-			return (!pnode && !other.pnode) || (pnode && other.pnode && (*pnode) == (*other.pnode));
-		}
-		bool operator!=(const node_iterator& other) { return !(*this == other); }
+		bool operator==(const node_iterator& other) const { return pnode == other.pnode; }
+		bool operator!=(const node_iterator& other) const { return !(*this == other); }
 		node_iterator& operator++() { pnode = this->successor(); return *this; }
 		node_iterator& operator--() { pnode = this->predecessor(); return *this; }
-		typename node_iterator::reference operator*() const { return pnode->data; }
-		typename node_iterator::pointer operator->() const { return &pnode->data; }
+		node_iterator operator++(int) { node_iterator tmp(*this); ++*this; return tmp; }
+		node_iterator operator--(int) { node_iterator tmp(*this); --*this; return tmp; }
+		reference operator*() const { return key(pnode); }
+		pointer operator->() const { return &key(pnode); }
 	private:
-		node* pnode;
+		friend class binary_search_tree;
+		base_ptr pnode;
 	};
 
 	typedef node_iterator<inorder_traversal> iterator;
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+#if __cplusplus >= 201103L
+	/* a node taken out of a tree by extract(), it owns the node and its key
+	 until insert() links it into a tree again. The key can be changed
+	 meanwhile. Frees the node through the allocator of the tree it came
+	 from, so it must not outlive that tree (or its clear() with a pool) */
+	class node_type {
+	public:
+		typedef _Key value_type;
+		typedef _Alloc allocator_type;
+
+		node_type() : pnode(NULL), alloc(NULL) { }
+		node_type(node_type&& other) : pnode(other.pnode), alloc(other.alloc) { other.pnode = NULL; }
+		~node_type() { reset(); }
+
+		node_type& operator=(node_type&& other) {
+			if (this != &other) {
+				reset();
+				pnode = other.pnode;
+				alloc = other.alloc;
+				other.pnode = NULL;
+			}
+			return *this;
+		}
+
+		bool empty() const { return pnode == NULL; }
+		explicit operator bool() const { return pnode != NULL; }
+		value_type& value() const { return pnode->data; }
+
+		void swap(node_type& other) {
+			std::swap(pnode, other.pnode);
+			std::swap(alloc, other.alloc);
+		}
+
+	private:
+		friend class binary_search_tree;
+
+		node_type(node* _pnode, node_allocator* _alloc) : pnode(_pnode), alloc(_alloc) { }
+		node_type(const node_type&);
+		node_type& operator=(const node_type&);
+
+		void reset() {
+			if (pnode) {
+				std::allocator_traits<node_allocator>::destroy(*alloc, &pnode->data);
+				alloc->deallocate(pnode, 1);
+				pnode = NULL;
+			}
+		}
+
+		node* pnode;
+		node_allocator* alloc;
+	};
+
+	// what insert(node_type&&) returns, node gets the handle back if the key was there
+	struct insert_return_type {
+		iterator position;
+		bool inserted;
+		node_type node;
+	};
+#endif
+
+	explicit binary_search_tree(const _Compare& comp = _Compare())
+		: m_size(0), m_comp(comp), arena(NULL), arena_size(0), arena_live(0) {
+		reset_header();
+	}
+
+	// build from a sorted range, see assign_sorted
+	template<typename _InputIterator>
+	binary_search_tree(sorted_unique_t, _InputIterator first, _InputIterator last,
+			const _Compare& comp = _Compare())
+		: m_size(0), m_comp(comp), arena(NULL), arena_size(0), arena_live(0) {
+		reset_header();
+		assign_sorted(first, last);
+	}
+
+	// deep copy, O(n) since the source is already sorted
+	binary_search_tree(const binary_search_tree& other)
+		: m_size(0), m_comp(other.m_comp), arena(NULL), arena_size(0), arena_live(0) {
+		reset_header();
+		if (!copy_block(other))
+			assign_sorted(other.begin(), other.end());
+	}
 
-	binary_search_tree() : root(NULL), m_size(0) { }
 	~binary_search_tree() { clear(); }
 
+	binary_search_tree& operator=(const binary_search_tree& other) {
+		if (this != &other) {
+			binary_search_tree tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+#if __cplusplus >= 201103L
+	// moves only swap pointers (and the node allocator, nodes live there)
+	binary_search_tree(binary_search_tree&& other)
+		: m_size(0), m_comp(other.m_comp), arena(NULL), arena_size(0), arena_live(0) {
+		reset_header();
+		swap(other);
+	}
+
+	binary_search_tree& operator=(binary_search_tree&& other) {
+		if (this != &other) {
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+#endif
+
+	void swap(binary_search_tree& other) {
+		using std::swap;
+		swap(header.edge[0], other.header.edge[0]);
+		swap(header.edge[1], other.header.edge[1]);
+		swap(leftmost, other.leftmost);
+		swap(m_size, other.m_size);
+		swap(m_comp, other.m_comp);
+		swap(node_alloc, other.node_alloc);
+		swap(m_stats, other.m_stats);
+		swap(arena, other.arena);
+		swap(arena_size, other.arena_size);
+		swap(arena_live, other.arena_live);
+		adopt_header();
+		other.adopt_header();
+	}
+
 	size_t size() const { return m_size; }
 
 	bool empty() const { return m_size == 0; }
 
-	void clear() { if (root) destroy_node_descendants(root); }
+	key_compare key_comp() const { return m_comp; }
+
+	void clear() {
+		/* a pool, or the block of compact() if it holds every node, can drop
+		 all nodes at once if no destructor has to run */
+		if (root()) {
+			if (detail::is_trivially_destructible<_Key>::value
+					&& (allocator_release<node_allocator>::release(node_alloc) || arena_live == m_size))
+				m_stats.deallocated(m_size);
+			else
+				destroy_tree(root());
+		}
+		if (arena)
+			release_arena(); // the pool or the block went without free_node
+		reset_header();
+		m_size = 0;
+	}
 
 	std::pair<iterator, bool> insert(const_reference x) {
-		// special case root is null
-		if (root == NULL) {
-			root = create_node(x, NULL); // create a node without a parent
-			return std::make_pair(begin(), true);
+		base_ptr pn;
+		int dir;
+		base_ptr n = find_insert_pos(x, pn, dir);
+		// we found the node, just return it
+		if (n)
+			return std::make_pair(iterator(n), false);
+		n = create_node(x);
+		link_node(n, pn, dir);
+		return std::make_pair(iterator(n), true);
+	}
+
+#if __cplusplus >= 201103L
+	std::pair<iterator, bool> insert(value_type&& x) {
+		base_ptr pn;
+		int dir;
+		base_ptr n = find_insert_pos(x, pn, dir);
+		if (n)
+			return std::make_pair(iterator(n), false);
+		n = create_node(std::move(x));
+		link_node(n, pn, dir);
+		return std::make_pair(iterator(n), true);
+	}
+
+	/* build the key in place from args, it is needed to find its spot so the
+	 node always gets allocated, and dropped again if the key is a duplicate */
+	template <typename... _Args>
+	std::pair<iterator, bool> emplace(_Args&&... args) {
+		node* n = create_node(std::forward<_Args>(args)...);
+		base_ptr pn;
+		int dir;
+		base_ptr found = find_insert_pos(n->data, pn, dir);
+		if (found) {
+			destroy_node(n);
+			return std::make_pair(iterator(found), false);
+		}
+		link_node(n, pn, dir);
+		return std::make_pair(iterator(n), true);
+	}
+
+	template <typename... _Args>
+	iterator emplace_hint(iterator hint, _Args&&... args) {
+		node* n = create_node(std::forward<_Args>(args)...);
+		base_ptr pn;
+		int dir;
+		base_ptr found = find_insert_pos(hint.pnode, n->data, pn, dir);
+		if (found) {
+			destroy_node(n);
+			return iterator(found);
 		}
+		link_node(n, pn, dir);
+		return iterator(n);
+	}
+
+	iterator insert(iterator hint, value_type&& x) {
+		base_ptr pn;
 		int dir;
-		node* pn = root, *n;
-		for (;;) {
-			// we found the node, just return it
-			if (x == pn->data)
-				return std::make_pair(iterator(pn, false), false);
-			// which direction (edge) to take
-			dir = (x < pn->data) ? 0 : 1;
-			// grab the kid
-			n = pn->edge[dir];
-			// if the kid is empty, we can insert here
-			if (n == NULL) {
-				// create node with parent node pn
-				n = create_node(x, pn);
-				// pn points to the newly created node n
-				pn->edge[dir] = n;
-				return std::make_pair(iterator(n, false), true);
-			} else
-				pn = n; // continue searching
-		}
-		// should never reach
-		return std::make_pair(end(), false);
+		base_ptr n = find_insert_pos(hint.pnode, x, pn, dir);
+		if (n)
+			return iterator(n);
+		n = create_node(std::move(x));
+		link_node(n, pn, dir);
+		return iterator(n);
 	}
+#endif
 
+	/* insert x right before hint if it belongs there (or right after it),
+	 O(1) amortized with red-black balancing. Otherwise this is insert(x) */
+	iterator insert(iterator hint, const_reference x) {
+		base_ptr pn;
+		int dir;
+		base_ptr n = find_insert_pos(hint.pnode, x, pn, dir);
+		if (n)
+			return iterator(n);
+		n = create_node(x);
+		link_node(n, pn, dir);
+		return iterator(n);
+	}
+
+	/* insert(end(), x): a key greater than max() hangs right of the cached
+	 right most node, no descent, even without balancing */
+	std::pair<iterator, bool> append_max(const_reference x) {
+		if (m_size && !m_comp(max(), x))
+			return insert(x);
+		base_ptr parent = m_size ? header.right() : end_node();
+		int dir = m_size ? 1 : 0;
+		base_ptr n = create_node(x);
+		link_node(n, parent, dir);
+		return std::make_pair(iterator(n), true);
+	}
+
+	// sorted ranges take the append_max() path
 	template<typename _InputIterator>
 	void insert(_InputIterator first, _InputIterator last) {
 		for (; first != last; ++first)
-			insert(*first);
+			insert(end(), *first);
 	}
 
-	size_t erase(const_reference x) {
-		int dir;
-		node* n = find_node(x, dir);
-		if (n == NULL)
-			return 0; // not found
-		node* pn = n->parent; // n's parent
-		node* rn = n->right(); // n's right kid
-		if (rn == NULL) {
-			// n has no right kid
-			if (n->left()) // if n's left is valid
-				n->left()->parent = pn; // set its parent to p
-			if (pn)
-				pn->edge[dir] = n->left(); // p links to n's lef
-			else
-				root = n->left();
-		} else {
-			if (rn->left() == NULL) {
-				// n's right kid has no left kid
-				rn->left(n->left()); // right kid inherit n's left
-				if (rn->left()) // set our new left kid rn as parent
-					rn->left()->parent = rn;
-				rn->parent = pn; // set right kid's parent to p
-				if (pn)
-					pn->edge[dir] = rn; // p links to right kid
+	/* replace the contents with the sorted range [first, last) in O(N),
+	 the result is perfectly balanced whatever the policy. Equal neighbours
+	 are stored once. If a key fails to copy the tree is left empty */
+	template<typename _InputIterator>
+	void assign_sorted(_InputIterator first, _InputIterator last) {
+		clear();
+		base_ptr head = NULL;
+		base_ptr tail = NULL;
+		try {
+			for (; first != last; ++first) {
+				if (tail && !m_comp(key(tail), *first))
+					continue;
+				base_ptr n = create_node(*first);
+				if (tail)
+					tail->edge[1] = n;
 				else
-					root = rn;
-			} else {
-				// n's right kid has a left kid
-				node* ln = node::left_most(rn->left()); // find left most descendant
-				// reassign ln's right kid
-				ln->parent->left(ln->right()); // ln's parent left points to ln's right
-				if (ln->right()) // if ln has a right kid
-					ln->right()->parent = ln->parent; // his parent is now ln's parent
-				std::swap(n, ln); // swap pointers (to destroy ln as n)
-				std::swap(n->data, ln->data); // swap data
+					head = n;
+				tail = n;
 			}
+		} catch (...) {
+			destroy_vine(head);
+			throw;
+		}
+		build_balanced(head, m_size);
+	}
+
+	/* insert the sorted range [first, last) of m keys. Small batches go
+	 through insert() one by one, O(m log n), bigger ones are merged with the
+	 existing nodes and the tree is rebuilt balanced in O(n + m), existing
+	 nodes are relinked, not reallocated. If a key fails to copy the tree
+	 keeps the keys it had and those merged before */
+	template<typename _ForwardIterator>
+	void bulk_insert(_ForwardIterator first, _ForwardIterator last) {
+		if (m_size == 0) {
+			assign_sorted(first, last);
+			return;
+		}
+		size_t m = std::distance(first, last);
+		int log_n = 0;
+		for (size_t n = m_size; n; n >>= 1)
+			++log_n;
+		if (m * log_n < m_size + m) {
+			insert(first, last);
+			return;
+		}
+		// merge the vine of current nodes with the batch into a new vine
+		base_ptr old = tree_to_vine();
+		base_ptr head = NULL;
+		base_ptr tail = NULL;
+		try {
+			while (old || first != last) {
+				base_ptr n;
+				if (first == last || (old && m_comp(key(old), *first))) {
+					n = old;
+					old = old->right();
+				} else {
+					if ((old && !m_comp(*first, key(old))) || (tail && !m_comp(key(tail), *first))) {
+						++first; // already there
+						continue;
+					}
+					n = create_node(*first);
+					++first;
+				}
+				if (tail)
+					tail->edge[1] = n;
+				else
+					head = n;
+				tail = n;
+			}
+		} catch (...) {
+			// the old nodes left all follow tail, m_size counts every node
+			if (tail)
+				tail->edge[1] = old;
+			else
+				head = old;
+			build_balanced(head, m_size);
+			throw;
 		}
-		destroy_node(n); // destroy n
+		build_balanced(head, m_size);
+	}
+
+	size_t erase(const_reference x) {
+		base_ptr n = find_node(x);
+		if (n == NULL)
+			return 0; // not found
+		unlink_node(n);
+		destroy_node(static_cast<node*>(n)); // destroy n
 		return 1;
 	}
 
@@ -207,78 +573,1146 @@ public:
 			erase(*first);
 	}
 
+#if __cplusplus >= 201103L
+	// unlink the node at pos and hand it over, nothing is freed
+	node_type extract(iterator pos) {
+		node* n = static_cast<node*>(pos.pnode);
+		node* out = in_arena(n) ? copy_out_of_arena(n) : n;
+		unlink_node(n);
+		--m_size;
+		if (out != n)
+			free_node(n);
+		return node_type(out, &node_alloc);
+	}
+
+	// an empty handle if x is not there
+	node_type extract(const_reference x) {
+		base_ptr n = find_node(x);
+		return n ? extract(iterator(n)) : node_type();
+	}
+
+	/* link the node of nh unless its key is there already. With equal
+	 allocators the node itself moves in, otherwise its key is moved into a
+	 node of ours */
+	insert_return_type insert(node_type&& nh) {
+		return insert_handle(end_node(), nh);
+	}
+
+	iterator insert(iterator hint, node_type&& nh) {
+		return insert_handle(hint.pnode, nh).position;
+	}
+#endif
+
+	/* move every node of other whose key is not here yet into this tree,
+	 the others stay in other. Nodes are relinked if the node allocators
+	 compare equal (pools never do) and copied otherwise. Other's keys come
+	 in order, each one is tried next to the previous one first. Nodes
+	 compact() put in a block are copied too */
+	void merge(binary_search_tree& other) {
+		if (&other == this)
+			return;
+		bool relink = node_alloc == other.node_alloc;
+		base_ptr hint = end_node();
+		for (iterator it = other.begin(); it != other.end(); ) {
+			base_ptr n = it.pnode;
+			++it; // unlink_node leaves the other nodes alone
+			base_ptr pn;
+			int dir;
+			base_ptr found = find_insert_pos(hint, key(n), pn, dir);
+			if (!found) {
+				node* m;
+				if (relink && !other.in_arena(static_cast<node*>(n))) {
+					other.unlink_node(n);
+					--other.m_size;
+					m = adopt_node(static_cast<node*>(n));
+				} else {
+					m = create_node(key(n));
+					other.unlink_node(n);
+					other.destroy_node(static_cast<node*>(n));
+				}
+				link_node(m, pn, dir);
+				found = m;
+			}
+			hint = (++iterator(found)).pnode;
+		}
+	}
+
 	size_t count(const_reference x) const {
-		int dir;
-		return find_node(x, dir) ? 1 : 0;
+		return find_node(x) ? 1 : 0;
 	}
 
 	iterator find(const_reference x) const {
-		int dir;
-		return iterator(find_node(x, dir), false);
+		base_ptr n = find_node(x);
+		return n ? iterator(n) : end();
+	}
+
+	// heterogeneous lookup, only with a transparent comparator (std::less<>)
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, size_t>::type count(const _Lookup& x) const {
+		return find_node(x) ? 1 : 0;
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type find(const _Lookup& x) const {
+		base_ptr n = find_node(x);
+		return n ? iterator(n) : end();
+	}
+
+	// first key not less than x
+	iterator lower_bound(const_reference x) const { return iterator(lower_bound_node(x)); }
+
+	// first key greater than x
+	iterator upper_bound(const_reference x) const { return iterator(upper_bound_node(x)); }
+
+	// at most one key, this is a set
+	std::pair<iterator, iterator> equal_range(const_reference x) const {
+		return std::make_pair(lower_bound(x), upper_bound(x));
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type lower_bound(const _Lookup& x) const {
+		return iterator(lower_bound_node(x));
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type upper_bound(const _Lookup& x) const {
+		return iterator(upper_bound_node(x));
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, std::pair<iterator, iterator> >::type
+	equal_range(const _Lookup& x) const {
+		return std::make_pair(lower_bound(x), upper_bound(x));
+	}
+
+	// lookups advancing together in find_batch / count_batch
+	static const size_t batch_width = 16;
+
+	// trees smaller than this are scanned by parallel_for_each on the calling thread
+	static const size_t parallel_grain = 1 << 14;
+
+	/* find() for every key of [first, last), results in order to out. Up to
+	 batch_width descents advance one level at a time side by side, each
+	 prefetches its next node and the others cover the miss */
+	template <typename _ForwardIterator, typename _OutputIterator>
+	_OutputIterator find_batch(_ForwardIterator first, _ForwardIterator last, _OutputIterator out) const {
+		base_ptr found[batch_width];
+		while (first != last) {
+			size_t k = find_nodes(first, last, found);
+			for (size_t i = 0; i < k; ++i)
+				*out++ = found[i] ? iterator(found[i]) : end();
+		}
+		return out;
+	}
+
+	// count() for every key of [first, last), like find_batch
+	template <typename _ForwardIterator, typename _OutputIterator>
+	_OutputIterator count_batch(_ForwardIterator first, _ForwardIterator last, _OutputIterator out) const {
+		base_ptr found[batch_width];
+		while (first != last) {
+			size_t k = find_nodes(first, last, found);
+			for (size_t i = 0; i < k; ++i)
+				*out++ = found[i] ? size_t(1) : size_t(0);
+		}
+		return out;
+	}
+
+	/* call f on every key in [lo, hi) in order, O(log n + k). Only the path
+	 down to lo is searched, the walk then stops at the first key >= hi so
+	 nothing outside the range is visited */
+	template <typename _Function>
+	_Function for_each_in_range(const_reference lo, const_reference hi, _Function f) const {
+		base_ptr end = end_node();
+		for (iterator it(lower_bound_node(lo)); it.pnode != end && m_comp(*it, hi); ++it)
+			f(*it);
+		return f;
+	}
+
+	/* write a bst_header and the keys in order as their bytes, in chunks.
+	 For trivially copyable keys, read back on a machine with the same byte
+	 order and key layout. Throws std::runtime_error if the stream fails */
+	void serialize(std::ostream& out) const {
+#if __cplusplus >= 201103L
+		static_assert(detail::is_trivially_copyable<_Key>::value, "serialize() writes keys as their bytes");
+#endif
+		bst_header hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		std::memcpy(hdr.magic, "yadsbst", 8);
+		hdr.version = snapshot_version;
+		hdr.byte_order = snapshot_byte_order;
+		hdr.key_size = sizeof(_Key);
+		hdr.count = m_size;
+		out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+		std::vector<_Key> chunk;
+		chunk.reserve(snapshot_chunk);
+		for (iterator it = begin(); it != end(); ++it) {
+			chunk.push_back(*it);
+			if (chunk.size() == snapshot_chunk) {
+				out.write(reinterpret_cast<const char*>(&chunk[0]), chunk.size() * sizeof(_Key));
+				chunk.clear();
+			}
+		}
+		if (!chunk.empty())
+			out.write(reinterpret_cast<const char*>(&chunk[0]), chunk.size() * sizeof(_Key));
+		if (!out)
+			throw std::runtime_error("binary_search_tree: cannot write snapshot");
+	}
+
+	/* replace the contents with a snapshot from serialize(). All nodes come
+	 from one allocation, in key order, and are linked with the balanced
+	 build of assign_sorted without a single comparison but the check that
+	 the keys are in order. The block works like the one of compact().
+	 Nothing is allocated for keys the stream does not have: a seekable
+	 stream must hold them all first, the keys of other streams are read
+	 before the block is allocated. A single key gets an ordinary node, a
+	 one node block could come from a pool (see clear()). Throws
+	 std::runtime_error on a bad snapshot, the tree is empty then */
+	void deserialize(std::istream& in) {
+#if __cplusplus >= 201103L
+		static_assert(detail::is_trivially_copyable<_Key>::value, "deserialize() reads keys as their bytes");
+#endif
+		clear();
+		bst_header hdr;
+		if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)))
+			throw std::runtime_error("binary_search_tree: snapshot too short");
+		if (std::memcmp(hdr.magic, "yadsbst", 8) != 0 || hdr.version != snapshot_version)
+			throw std::runtime_error("binary_search_tree: not a snapshot");
+		if (hdr.byte_order != snapshot_byte_order || hdr.key_size != sizeof(_Key))
+			throw std::runtime_error("binary_search_tree: snapshot written for another key type or machine");
+		size_t count = static_cast<size_t>(hdr.count);
+		if (count != hdr.count || count > node_alloc.max_size())
+			throw std::runtime_error("binary_search_tree: snapshot too large");
+		if (count == 0)
+			return;
+		long long left = bytes_left(in);
+		if (left >= 0 && static_cast<unsigned long long>(left) / sizeof(_Key) < count)
+			throw std::runtime_error("binary_search_tree: snapshot truncated");
+		node* block = left >= 0 && count > 1 ? node_alloc.allocate(count) : NULL;
+		std::vector<_Key> staged; // the keys while there is no block
+		try {
+			std::vector<_Key> chunk(std::min(count, size_t(snapshot_chunk)));
+			for (size_t done = 0; done < count; ) {
+				size_t k = std::min(count - done, chunk.size());
+				if (!in.read(reinterpret_cast<char*>(&chunk[0]), k * sizeof(_Key)))
+					throw std::runtime_error("binary_search_tree: snapshot truncated");
+				for (size_t i = 0; i < k; ++i, ++done) {
+					if (done > 0 && !m_comp(block ? block[done - 1].data : staged.back(), chunk[i]))
+						throw std::runtime_error("binary_search_tree: snapshot keys out of order");
+					if (block)
+						std::memcpy(static_cast<void*>(&block[done].data), static_cast<const void*>(&chunk[i]), sizeof(_Key));
+					else
+						staged.push_back(chunk[i]);
+				}
+			}
+			if (!block && count > 1) {
+				block = node_alloc.allocate(count);
+				for (size_t i = 0; i < count; ++i)
+					std::memcpy(static_cast<void*>(&block[i].data), static_cast<const void*>(&staged[i]), sizeof(_Key));
+			}
+		} catch (...) {
+			if (block)
+				node_alloc.deallocate(block, count); // keys are trivial, nothing to destroy
+			throw;
+		}
+		if (count == 1) {
+			build_balanced(create_node(staged[0]), 1);
+			return;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			block[i].parent = NULL;
+			block[i].edge[0] = NULL;
+			block[i].edge[1] = i + 1 < count ? &block[i + 1] : NULL;
+			_Balance::init(&block[i]);
+			m_stats.allocated();
+		}
+		m_size = count;
+		build_balanced(&block[0], count);
+		arena = block;
+		arena_size = arena_live = count;
+	}
+
+	/* copy every node into one contiguous block, laid out in van Emde Boas
+	 order: the top half of the levels first, then each subtree hanging
+	 below them, recursively. A search then stays within few cache lines
+	 and pages whatever the block size, even after a long churn scattered
+	 the nodes over the heap. O(n log log n) for a balanced tree, keys are
+	 moved when their move constructor cannot throw, copied otherwise, and
+	 whole nodes are copied as bytes when they are trivially copyable.
+	 Copies of a compacted tree do that too, see copy_block. Iterators are
+	 invalidated, the tree's shape does not change. Nodes inserted later
+	 are allocated as usual, the block goes away with the last of its nodes */
+	void compact() {
+		if (m_size < 2)
+			return; // a one node block could come from a pool, see clear()
+		std::vector<base_ptr> order;
+		order.reserve(m_size);
+		veb_order(root(), height(), order);
+		node* block = node_alloc.allocate(m_size);
+		size_t built = trivial_nodes ? m_size : 0;
+		if (trivial_nodes) {
+			for (size_t i = 0; i < m_size; ++i)
+				std::memcpy(static_cast<void*>(&block[i]), static_cast<const void*>(order[i]), sizeof(node));
+		}
+		try {
+			for (; built < m_size; ++built) {
+				node* from = static_cast<node*>(order[built]);
+#if __cplusplus >= 201103L
+				std::allocator_traits<node_allocator>::construct(node_alloc, &block[built].data,
+					std::move_if_noexcept(from->data));
+#else
+				::new (static_cast<void*>(&block[built].data)) _Key(from->data);
+#endif
+			}
+		} catch (...) {
+			while (built > 0)
+				block[--built].data.~_Key();
+			node_alloc.deallocate(block, m_size);
+			throw;
+		}
+		// links still point to the old nodes, whose parent now forwards to the copy
+		for (size_t i = 0; i < m_size; ++i) {
+			if (!trivial_nodes)
+				static_cast<node_base&>(block[i]) = *order[i];
+			order[i]->parent = &block[i];
+		}
+		for (size_t i = 0; i < m_size; ++i) {
+			node_base& n = block[i];
+			if (n.parent != &header)
+				n.parent = n.parent->parent;
+			for (int dir = 0; dir < 2; ++dir) {
+				if (n.edge[dir])
+					n.edge[dir] = n.edge[dir]->parent;
+			}
+			m_stats.allocated();
+		}
+		root() = root()->parent;
+		leftmost = leftmost->parent;
+		header.edge[1] = header.edge[1]->parent;
+		for (size_t i = 0; i < m_size; ++i)
+			free_node(static_cast<node*>(order[i])); // the old block too, if there was one
+		arena = block;
+		arena_size = arena_live = m_size;
 	}
 
-	iterator begin() const { return iterator(root, true); }
-	iterator end() const { return iterator(NULL, false); }
+	typedef std::pair<iterator, iterator> range;
 
-	const_reference min() const {
-		node* n = node::left_most(root);
-		return n->data;
+	/* cut the keys into at most parts consecutive ranges, in order, that
+	 cover the tree. With subtree sizes (order_statistics) they are equal to
+	 one key, O(parts log n). Otherwise the nodes of the top log2(parts)
+	 levels are the cuts, about equal in a balanced tree, O(parts) */
+	std::vector<range> split_ranges(size_t parts) const {
+		std::vector<base_ptr> cuts;
+		if (parts > 1 && root())
+			find_cuts(cuts, parts, detail::bool_tag<has_subtree_size<_Augment>::value>());
+		std::vector<range> ranges;
+		base_ptr first = leftmost;
+		for (size_t i = 0; i < cuts.size(); ++i) {
+			ranges.push_back(range(iterator(first), iterator(cuts[i])));
+			first = cuts[i];
+		}
+		if (root())
+			ranges.push_back(range(iterator(first), end()));
+		return ranges;
+	}
+
+#if __cplusplus >= 201103L
+	/* call f on every key, on all cores. The tree is cut into a few ranges
+	 per thread and every thread takes the next range left until none is,
+	 so a slow part does not hold up the others. Each range is walked in
+	 order but the ranges run concurrently, f must be safe to call from
+	 several threads. The tree must not change meanwhile */
+	template <typename _Function>
+	void parallel_for_each(_Function f) const {
+		unsigned threads = std::thread::hardware_concurrency();
+		if (threads < 2 || m_size < parallel_grain) {
+			std::for_each(begin(), end(), f);
+			return;
+		}
+		std::vector<range> ranges = split_ranges(4 * threads);
+		std::atomic<size_t> next(0);
+		std::vector<std::future<void> > helpers;
+		for (unsigned i = 1; i < threads; ++i) {
+			helpers.push_back(std::async(std::launch::async, &binary_search_tree::scan_ranges<_Function>,
+				std::cref(ranges), std::ref(next), std::ref(f)));
+		}
+		scan_ranges(ranges, next, f); // the futures wait for their threads if this throws
+		for (size_t i = 0; i < helpers.size(); ++i)
+			helpers[i].get();
+	}
+#endif
+
+	/* order statistics, need order_statistics in _Augment, all O(log n) */
+
+	// number of keys less than x
+	size_t rank(const_reference x) const {
+		size_t r = 0;
+		base_ptr n = root();
+		while (n) {
+			if (m_comp(key(n), x)) {
+				r += order_statistics::size(n->left()) + 1;
+				n = n->right();
+			} else {
+				n = n->left();
+			}
+		}
+		return r;
 	}
 
-	const_reference max() const {
-		node* n = node::right_most(root);
-		return n->data;
+	// the k-th smallest key (from 0), end() if k >= size()
+	iterator select(size_t k) const {
+		base_ptr n = root();
+		while (n) {
+			size_t l = order_statistics::size(n->left());
+			if (k < l) {
+				n = n->left();
+			} else if (k == l) {
+				return iterator(n);
+			} else {
+				k -= l + 1;
+				n = n->right();
+			}
+		}
+		return end();
 	}
 
+	// number of keys in [lo, hi)
+	size_t count_in_range(const_reference lo, const_reference hi) const {
+		if (!m_comp(lo, hi))
+			return 0;
+		return rank(hi) - rank(lo);
+	}
+
+	// all O(1), the extremes are cached
+	iterator begin() const { return iterator(leftmost); }
+	iterator end() const { return iterator(end_node()); }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return key(leftmost); }
+
+	const_reference max() const { return key(header.right()); }
+
+	/* shape of the tree, O(n) walks with O(1) extra memory */
+
+	// number of levels, 0 when empty
+	size_t height() const { return depth_histogram().size(); }
+
+	// element d counts the nodes at depth d, the root is at 0
+	std::vector<size_t> depth_histogram() const {
+		std::vector<size_t> h;
+		base_ptr n = root();
+		if (!n)
+			return h;
+		size_t d = 0;
+		for (; n->left(); ++d)
+			n = n->left();
+		for (;;) {
+			if (h.size() <= d)
+				h.resize(d + 1);
+			++h[d];
+			// successor() keeping track of the depth
+			if (n->right()) {
+				n = n->right();
+				for (++d; n->left(); ++d)
+					n = n->left();
+			} else {
+				for (; n != n->parent->left(); --d)
+					n = n->parent;
+				n = n->parent;
+				if (n == end_node())
+					break;
+				--d;
+			}
+		}
+		return h;
+	}
+
+	// nodes on the way from the root to a key, on average over all keys
+	double average_path_length() const {
+		std::vector<size_t> h = depth_histogram();
+		double sum = 0;
+		for (size_t d = 0; d < h.size(); ++d)
+			sum += double(d + 1) * h[d];
+		return m_size ? sum / m_size : 0;
+	}
+
+	// counters of the _Stats policy
+	const _Stats& stats() const { return m_stats; }
+
+	void reset_stats() { m_stats = _Stats(); }
+
 private:
-	node* root;
+	node_base header; // see node_base
+
+	base_ptr leftmost; // begin(), the header when empty
 
 	size_t m_size;
 
-	// rebind to allocate nodes instead of _Key
-	typename allocator_type::template rebind<node>::other node_alloc;
+	_Compare m_comp;
+
+	node_allocator node_alloc;
+
+	mutable _Stats m_stats; // lookups are const
+
+	// the block compact() put the nodes in, it goes with the last of them
+	node* arena;
+	size_t arena_size;
+	size_t arena_live;
+
+	bool in_arena(const node* pnode) const {
+		return arena && !std::less<const node*>()(pnode, arena)
+			&& std::less<const node*>()(pnode, arena + arena_size);
+	}
+
+	static const uint32_t snapshot_version = 1;
+	static const uint32_t snapshot_byte_order = 0x01020304;
+
+	// keys per write or read of a snapshot
+	static const size_t snapshot_chunk = 1 << 13;
+
+	void release_arena() {
+		node_alloc.deallocate(arena, arena_size);
+		arena = NULL;
+		arena_size = arena_live = 0;
+	}
+
+	/* copy constructor for a tree that is one full block after compact():
+	 trivially copyable nodes are copied with one memcpy, then every link is
+	 moved by the distance between the blocks. False if other is not like
+	 that, this tree must be empty */
+	bool copy_block(const binary_search_tree& other) {
+		if (!trivial_nodes || !other.arena || other.m_size < 2 || other.arena_size != other.m_size
+				|| other.arena_live != other.m_size)
+			return false;
+		node* block = node_alloc.allocate(other.m_size);
+		std::memcpy(static_cast<void*>(block), static_cast<const void*>(other.arena), other.m_size * sizeof(node));
+		for (size_t i = 0; i < other.m_size; ++i) {
+			node_base& n = block[i];
+			n.parent = (n.parent == &other.header) ? &header : moved(n.parent, other.arena, block);
+			for (int dir = 0; dir < 2; ++dir) {
+				if (n.edge[dir])
+					n.edge[dir] = moved(n.edge[dir], other.arena, block);
+			}
+			m_stats.allocated();
+		}
+		root() = moved(other.root(), other.arena, block);
+		leftmost = moved(other.leftmost, other.arena, block);
+		header.edge[1] = moved(other.header.right(), other.arena, block);
+		m_size = arena_size = arena_live = other.m_size;
+		arena = block;
+		return true;
+	}
+
+	// where pnode of the block at from is in the copy at to
+	static base_ptr moved(const node_base* pnode, const node* from, node* to) {
+		return to + (static_cast<const node*>(pnode) - from);
+	}
+
+	/* n's subtree down to h levels in van Emde Boas order: the top h / 2
+	 levels, then each subtree hanging below them, recursively */
+	static void veb_order(base_ptr n, size_t h, std::vector<base_ptr>& out) {
+		if (h == 1) {
+			out.push_back(n);
+			return;
+		}
+		size_t top = h / 2;
+		veb_order(n, top, out);
+		std::vector<std::pair<base_ptr, size_t> > stack(1, std::make_pair(n, size_t(0)));
+		std::vector<base_ptr> bottoms; // left to right
+		while (!stack.empty()) {
+			base_ptr p = stack.back().first;
+			size_t depth = stack.back().second;
+			stack.pop_back();
+			if (depth == top) {
+				bottoms.push_back(p);
+				continue;
+			}
+			if (p->right())
+				stack.push_back(std::make_pair(p->right(), depth + 1));
+			if (p->left())
+				stack.push_back(std::make_pair(p->left(), depth + 1));
+		}
+		for (size_t i = 0; i < bottoms.size(); ++i)
+			veb_order(bottoms[i], h - top, out);
+	}
+
+	// the root hangs left of the header
+	base_ptr& root() { return header.edge[0]; }
+	base_ptr root() const { return header.edge[0]; }
+
+	base_ptr end_node() const { return const_cast<base_ptr>(&header); }
+
+	// empty tree, begin() == end() == header
+	void reset_header() {
+		header.parent = NULL;
+		header.edge[0] = NULL;
+		header.edge[1] = leftmost = &header;
+	}
+
+	// links swapped in from another tree still point to its header
+	void adopt_header() {
+		if (root())
+			root()->parent = &header;
+		else
+			reset_header();
+	}
+
+	// recompute the augmented data of pnode from its key and kids
+	static void update_node(base_ptr pnode) {
+		_Augment::update(static_cast<node*>(pnode));
+	}
+
+	// recompute pnode and all its ancestors
+	void propagate(base_ptr pnode) {
+		if (!_Augment::active)
+			return;
+		for (; pnode && pnode != &header; pnode = pnode->parent)
+			update_node(pnode);
+	}
+
+	// what the balancing policy gets to see of the tree
+	struct rebalance_ops {
+		base_ptr& root;
+		_Stats& stats;
+
+		rebalance_ops(base_ptr& _root, _Stats& _stats) : root(_root), stats(_stats) { }
+
+		// pnode goes down to its dir side, its opposite kid takes its place
+		base_ptr rotate(base_ptr pnode, int dir) {
+			stats.rotated();
+			base_ptr kid = pnode->edge[1 - dir];
+			pnode->edge[1 - dir] = kid->edge[dir];
+			if (kid->edge[dir])
+				kid->edge[dir]->parent = pnode;
+			kid->parent = pnode->parent;
+			// the root is the header's left kid, so this also updates root
+			pnode->parent->edge[(pnode == pnode->parent->left()) ? 0 : 1] = kid;
+			kid->edge[dir] = pnode;
+			pnode->parent = kid;
+			// pnode is below kid now, both cover different keys
+			if (_Augment::active) {
+				update_node(pnode);
+				update_node(kid);
+			}
+			return kid;
+		}
+	};
+
+	/* find where x goes: returns the node holding an equal key, or NULL and
+	 x belongs at parent->edge[dir] (the header and 0 for an empty tree) */
+	template <typename _Lookup>
+	base_ptr find_insert_pos(const _Lookup& x, base_ptr& parent, int& dir) const {
+		base_ptr n = root();
+		base_ptr le = NULL; // last node not greater than x, the only one that can be equal
+		parent = end_node();
+		dir = 0;
+		m_stats.searched();
+		while (n) {
+			parent = n;
+			// which direction (edge) to take, one comparison per level
+			if (branchless) {
+				detail::prefetch(n->edge[0]);
+				detail::prefetch(n->edge[1]);
+				dir = !compare(x, key(n));
+				le = dir ? n : le;
+			} else if (compare(x, key(n))) {
+				dir = 0;
+			} else {
+				dir = 1;
+				le = n;
+			}
+			n = n->edge[dir];
+		}
+		return (le && !compare(key(le), x)) ? le : NULL;
+	}
+
+	/* find_insert_pos next to hint: x goes between hint's predecessor and
+	 hint, or between hint and its successor. Either way one of the two has
+	 a free edge on the side facing x. Descends from the root when x does
+	 not belong there */
+	template <typename _Lookup>
+	base_ptr find_insert_pos(base_ptr hint, const _Lookup& x, base_ptr& parent, int& dir) const {
+		if (hint == end_node()) {
+			if (!root()) { // not m_size, emplace_hint counts its node already
+				parent = end_node();
+				dir = 0;
+				return NULL;
+			}
+			if (m_comp(max(), x)) {
+				parent = header.right();
+				dir = 1;
+				return NULL;
+			}
+		} else if (m_comp(x, key(hint))) {
+			base_ptr prev = hint == leftmost ? NULL : (--iterator(hint)).pnode;
+			if (!prev || m_comp(key(prev), x)) {
+				// hint is the left most of prev's right subtree if that is not empty
+				if (!prev || prev->right()) {
+					parent = hint;
+					dir = 0;
+				} else {
+					parent = prev;
+					dir = 1;
+				}
+				return NULL;
+			}
+		} else if (m_comp(key(hint), x)) {
+			base_ptr next = (++iterator(hint)).pnode;
+			if (next == end_node() || m_comp(x, key(next))) {
+				if (hint->right()) {
+					parent = next;
+					dir = 0;
+				} else {
+					parent = hint;
+					dir = 1;
+				}
+				return NULL;
+			}
+		} else {
+			return hint;
+		}
+		return find_insert_pos(x, parent, dir);
+	}
+
+	// hang the fresh node n at parent->edge[dir], then let the policy rotate
+	void link_node(base_ptr n, base_ptr parent, int dir) {
+		n->parent = parent;
+		parent->edge[dir] = n;
+		if (parent == &header) {
+			leftmost = header.edge[1] = n; // first node
+		} else if (dir == 0) {
+			if (parent == leftmost)
+				leftmost = n;
+		} else if (parent == header.right()) {
+			header.edge[1] = n;
+		}
+		propagate(n);
+		rebalance_ops ops(root(), m_stats);
+		_Balance::after_insert(n, ops);
+	}
+
+	// make pnode's parent (the header for the root) point to kid instead
+	void replace_kid(base_ptr pnode, base_ptr kid) {
+		pnode->parent->edge[(pnode == pnode->parent->left()) ? 0 : 1] = kid;
+	}
+
+	/* unlink n from the tree without moving any data around, other nodes
+	 (and iterators to them) stay valid. If n has two kids its successor
+	 takes n's place and n's balancing data, then the policy fixes up the
+	 position the successor left behind */
+	void unlink_node(base_ptr n) {
+		// keep the cached extremes, an extreme lacks one kid so this is cheap
+		if (n == leftmost)
+			leftmost = n->right() ? node_base::left_most(n->right()) : n->parent;
+		if (n == header.right())
+			header.edge[1] = n->left() ? node_base::right_most(n->left()) : n->parent;
+		base_ptr kid; // takes over the removed position
+		base_ptr kid_parent;
+		int dir;
+		if (n->left() == NULL || n->right() == NULL) {
+			kid = n->edge[n->left() ? 0 : 1];
+			kid_parent = n->parent;
+			dir = (n == kid_parent->left()) ? 0 : 1;
+			replace_kid(n, kid);
+			if (kid)
+				kid->parent = kid_parent;
+			if (kid_parent == &header)
+				kid_parent = NULL; // kid is the new root
+		} else {
+			base_ptr s = node_base::left_most(n->right()); // successor
+			kid = s->right();
+			if (s->parent == n) {
+				kid_parent = s;
+				dir = 1;
+			} else {
+				kid_parent = s->parent;
+				dir = 0;
+				kid_parent->left(kid);
+				if (kid)
+					kid->parent = kid_parent;
+				s->edge[1] = n->right();
+				s->right()->parent = s;
+			}
+			s->left(n->left());
+			s->left()->parent = s;
+			replace_kid(n, s);
+			s->parent = n->parent;
+			std::swap(static_cast<typename _Balance::node_data&>(*s),
+				static_cast<typename _Balance::node_data&>(*n));
+		}
+		// every subtree that lost a key hangs off kid_parent (s included)
+		propagate(kid_parent);
+		rebalance_ops ops(root(), m_stats);
+		_Balance::after_erase(n, kid, kid_parent, dir, ops);
+	}
 
-	// post process this node down, destroying also all descendants
-	void destroy_node_descendants(node* pnode) {
-		if (pnode->left())
-			destroy_node_descendants(pnode->left());
-		if (pnode->right())
-			destroy_node_descendants(pnode->right());
-		if (pnode->parent) {
-			pnode->parent->edge[(*pnode < *pnode->parent) ? 0 : 1] = NULL;
+	/* destroy pnode and all its descendants without recursion: rotate left
+	 kids up until the current node has none, then free it and move on to
+	 its right kid. Every rotation puts one node on the right spine for good
+	 so this is O(n) with O(1) memory. The whole subtree goes away so parent
+	 pointers and the size are left alone (see clear) */
+	void destroy_tree(base_ptr pnode) {
+		while (pnode) {
+			base_ptr l = pnode->left();
+			if (l) {
+				pnode->left(l->right());
+				l->edge[1] = pnode;
+				pnode = l;
+			} else {
+				base_ptr r = pnode->right();
+				free_node(static_cast<node*>(pnode));
+				pnode = r;
+			}
 		}
-		destroy_node(pnode);
 	}
 
-	// deallocates pnode and decrement size
+	/* flatten the tree into a list of nodes in order, linked through edge[1]
+	 (a vine). Same right rotations as destroy_tree, O(n) with O(1) memory.
+	 The tree is left empty */
+	base_ptr tree_to_vine() {
+		base_ptr head = NULL;
+		base_ptr tail = NULL;
+		base_ptr pnode = root();
+		while (pnode) {
+			base_ptr l = pnode->left();
+			if (l) {
+				pnode->left(l->right());
+				l->edge[1] = pnode;
+				pnode = l;
+			} else {
+				if (tail)
+					tail->edge[1] = pnode;
+				else
+					head = pnode;
+				tail = pnode;
+				pnode = pnode->right();
+			}
+		}
+		if (tail)
+			tail->edge[1] = NULL;
+		reset_header();
+		return head;
+	}
+
+	// bytes from the read position to the end of a seekable stream, -1 for other streams
+	static long long bytes_left(std::istream& in) {
+		std::istream::pos_type here = in.tellg();
+		if (here == std::istream::pos_type(-1))
+			return -1;
+		in.seekg(0, std::ios::end);
+		std::istream::pos_type stop = in.tellg();
+		in.clear();
+		in.seekg(here);
+		if (stop == std::istream::pos_type(-1) || !in)
+			return -1;
+		return static_cast<long long>(stop - here);
+	}
+
+	// destroy every node of a vine
+	void destroy_vine(base_ptr vine) {
+		while (vine) {
+			base_ptr n = vine;
+			vine = vine->right();
+			destroy_node(static_cast<node*>(n));
+		}
+	}
+
+	// turn the first n nodes of a vine into a perfectly balanced tree as root
+	void build_balanced(base_ptr vine, size_t n) {
+		int tree_height = 0;
+		for (size_t full = 0; full < n; full = 2 * full + 1)
+			++tree_height;
+		int height;
+		root() = build_balanced(vine, n, 0, tree_height, height);
+		if (root()) {
+			root()->parent = &header;
+			leftmost = node_base::left_most(root());
+			header.edge[1] = node_base::right_most(root());
+		}
+	}
+
+	/* build the subtree of the next n nodes of the vine, vine moves past
+	 them. Left gets (n - 1) / 2 nodes so every leaf lands on one of the two
+	 bottom levels, height returns the subtree height */
+	base_ptr build_balanced(base_ptr& vine, size_t n, int depth, int tree_height, int& height) {
+		if (n == 0) {
+			height = 0;
+			return NULL;
+		}
+		int lh, rh;
+		base_ptr l = build_balanced(vine, (n - 1) / 2, depth + 1, tree_height, lh);
+		base_ptr m = vine;
+		vine = vine->right();
+		base_ptr r = build_balanced(vine, n / 2, depth + 1, tree_height, rh);
+		m->edge[0] = l;
+		m->edge[1] = r;
+		if (l)
+			l->parent = m;
+		if (r)
+			r->parent = m;
+		height = 1 + std::max(lh, rh);
+		_Balance::after_build(m, height, depth, tree_height);
+		if (_Augment::active)
+			update_node(m);
+		return m;
+	}
+
+	// destroys the key and deallocates pnode
+	void free_node(node* pnode) {
+#if __cplusplus >= 201103L
+		std::allocator_traits<node_allocator>::destroy(node_alloc, &pnode->data);
+#else
+		pnode->data.~_Key();
+#endif
+		if (in_arena(pnode)) {
+			if (--arena_live == 0)
+				release_arena();
+		} else {
+			node_alloc.deallocate(pnode, 1);
+		}
+		m_stats.deallocated();
+	}
+
+	// free_node and decrement size
 	void destroy_node(node* pnode) {
-		if (--m_size == 0 && pnode->parent == NULL)
-			root = NULL; // special case
-		node_alloc.deallocate(pnode, 1);
+		--m_size;
+		free_node(pnode);
+	}
+
+	// allocates a new unlinked node, constructs its key and increment size
+#if __cplusplus >= 201103L
+	template <typename... _Args>
+	node* create_node(_Args&&... args) {
+		node* nn = node_alloc.allocate(1);
+		try {
+			std::allocator_traits<node_allocator>::construct(node_alloc, &nn->data, std::forward<_Args>(args)...);
+		} catch (...) {
+			node_alloc.deallocate(nn, 1);
+			throw;
+		}
+		return init_node(nn);
 	}
+#else
+	node* create_node(const_reference x) {
+		node* nn = node_alloc.allocate(1);
+		try {
+			::new (static_cast<void*>(&nn->data)) _Key(x);
+		} catch (...) {
+			node_alloc.deallocate(nn, 1);
+			throw;
+		}
+		return init_node(nn);
+	}
+#endif
 
-	// allocates a new node and increment size
-	node* create_node(const_reference x, node* parent) {
+#if __cplusplus >= 201103L
+	// a node of its own for the key of an arena node, for node handles
+	node* copy_out_of_arena(node* pnode) {
 		node* nn = node_alloc.allocate(1);
-		nn->data = x;
-		nn->parent = parent;
+		try {
+			std::allocator_traits<node_allocator>::construct(node_alloc, &nn->data, std::move_if_noexcept(pnode->data));
+		} catch (...) {
+			node_alloc.deallocate(nn, 1);
+			throw;
+		}
+		m_stats.allocated();
+		return nn;
+	}
+#endif
+
+	node* init_node(node* nn) {
+		m_stats.allocated();
+		return adopt_node(nn);
+	}
+
+	// a node holding its key, fresh or from another tree, ready for link_node
+	node* adopt_node(node* nn) {
+		nn->parent = NULL;
+		nn->edge[0] = nn->edge[1] = NULL;
+		_Balance::init(nn);
 		++m_size;
 		return nn;
 	}
 
-	/* find a node by its value, also return the direction
-	 from which we got there (from a parents perspective) */
-	node* find_node(const_reference x, int &dir) const {
-		dir = 0; // default left (see erase)
-		node* n = root;
-		while (n && x != n->data) {
-			dir = (x < n->data) ? 0 : 1;
-			n = n->edge[dir];
+	// first node not less than x or the header, one comparison per level
+	template <typename _Lookup>
+	base_ptr lower_bound_node(const _Lookup& x) const {
+		base_ptr n = root();
+		base_ptr ge = end_node(); // last node not less than x
+		m_stats.searched();
+		while (n) {
+			if (branchless) {
+				detail::prefetch(n->edge[0]);
+				detail::prefetch(n->edge[1]);
+				bool less = compare(key(n), x);
+				ge = less ? ge : n;
+				n = n->edge[less];
+			} else if (compare(key(n), x)) {
+				n = n->right();
+			} else {
+				ge = n;
+				n = n->left();
+			}
+		}
+		return ge;
+	}
+
+	// first node greater than x or the header
+	template <typename _Lookup>
+	base_ptr upper_bound_node(const _Lookup& x) const {
+		base_ptr n = root();
+		base_ptr gt = end_node();
+		m_stats.searched();
+		while (n) {
+			if (branchless) {
+				detail::prefetch(n->edge[0]);
+				detail::prefetch(n->edge[1]);
+				bool greater = compare(x, key(n));
+				gt = greater ? n : gt;
+				n = n->edge[!greater];
+			} else if (compare(x, key(n))) {
+				gt = n;
+				n = n->left();
+			} else {
+				n = n->right();
+			}
 		}
-		return n;
+		return gt;
+	}
+
+	/* find_node for the next batch_width keys at most, first moves past
+	 them. Each round takes every unfinished descent one level down */
+	template <typename _ForwardIterator>
+	size_t find_nodes(_ForwardIterator& first, _ForwardIterator last, base_ptr* found) const {
+		_ForwardIterator keys[batch_width];
+		base_ptr n[batch_width];
+		size_t k = 0;
+		for (; k < batch_width && first != last; ++k, ++first) {
+			keys[k] = first;
+			m_stats.searched();
+			n[k] = root();
+			found[k] = end_node(); // last node not less than the key so far
+		}
+		for (size_t active = k; active > 0; ) {
+			active = 0;
+			for (size_t i = 0; i < k; ++i) {
+				base_ptr p = n[i];
+				if (!p)
+					continue;
+				if (branchless) {
+					bool less = compare(key(p), *keys[i]);
+					found[i] = less ? found[i] : p;
+					p = p->edge[less];
+				} else if (compare(key(p), *keys[i])) {
+					p = p->right();
+				} else {
+					found[i] = p;
+					p = p->left();
+				}
+				n[i] = p;
+				if (p) {
+					detail::prefetch(p);
+					detail::prefetch(&key(p));
+					++active;
+				}
+			}
+		}
+		for (size_t i = 0; i < k; ++i) {
+			if (found[i] == end_node() || compare(*keys[i], key(found[i])))
+				found[i] = NULL;
+		}
+		return k;
+	}
+
+#if __cplusplus >= 201103L
+	insert_return_type insert_handle(base_ptr hint, node_type& nh) {
+		insert_return_type ret = { end(), false, node_type() };
+		if (nh.empty())
+			return ret;
+		base_ptr pn;
+		int dir;
+		base_ptr found = find_insert_pos(hint, nh.pnode->data, pn, dir);
+		if (found) {
+			ret.position = iterator(found);
+			ret.node = std::move(nh);
+			return ret;
+		}
+		node* n;
+		if (*nh.alloc == node_alloc) {
+			n = adopt_node(nh.pnode);
+			nh.pnode = NULL;
+		} else {
+			n = create_node(std::move(nh.pnode->data));
+			nh.reset();
+		}
+		link_node(n, pn, dir);
+		ret.position = iterator(n);
+		ret.inserted = true;
+		return ret;
+	}
+#endif
+
+	// the k-th node for k = n / parts, 2n / parts...
+	void find_cuts(std::vector<base_ptr>& cuts, size_t parts, detail::bool_tag<true>) const {
+		size_t last = 0;
+		for (size_t i = 1; i < parts; ++i) {
+			size_t k = i * m_size / parts;
+			if (k > last) {
+				cuts.push_back(select(k).pnode);
+				last = k;
+			}
+		}
+	}
+
+	// the nodes of the top levels, in order
+	void find_cuts(std::vector<base_ptr>& cuts, size_t parts, detail::bool_tag<false>) const {
+		int levels = 0;
+		for (size_t ranges = 2; ranges <= parts; ranges *= 2)
+			++levels;
+		top_nodes(root(), levels, cuts);
+	}
+
+	static void top_nodes(base_ptr n, int levels, std::vector<base_ptr>& out) {
+		if (!n || levels == 0)
+			return;
+		top_nodes(n->left(), levels - 1, out);
+		out.push_back(n);
+		top_nodes(n->right(), levels - 1, out);
+	}
+
+#if __cplusplus >= 201103L
+	template <typename _Function>
+	static void scan_ranges(const std::vector<range>& ranges, std::atomic<size_t>& next, _Function& f) {
+		for (size_t i = next++; i < ranges.size(); i = next++) {
+			for (iterator it = ranges[i].first; it != ranges[i].second; ++it)
+				f(*it);
+		}
+	}
+#endif
+
+	/* find a node by its value. Descends like lower_bound with a single
+	 comparison per level and checks the candidate for equality at the end */
+	template <typename _Lookup>
+	base_ptr find_node(const _Lookup& x) const {
+		base_ptr ge = lower_bound_node(x);
+		return (ge != &header && !compare(x, key(ge))) ? ge : NULL;
+	}
+
+	// m_comp for the searches, counted by the stats policy
+	template <typename _Left, typename _Right>
+	bool compare(const _Left& a, const _Right& b) const {
+		m_stats.compared();
+		return m_comp(a, b);
 	}
 };
 
+template <typename _Key, typename _Compare, typename _Alloc, typename _Balance, typename _Augment,
+	typename _Stats>
+inline void swap(binary_search_tree<_Key, _Compare, _Alloc, _Balance, _Augment, _Stats>& a,
+		binary_search_tree<_Key, _Compare, _Alloc, _Balance, _Augment, _Stats>& b) {
+	a.swap(b);
+}
+
 }; // namespace
 
 #endif /* BST_H_ */
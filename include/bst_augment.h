@@ -0,0 +1,96 @@
+/*
+ * bst_augment.h
+ *
+ *  Augmentation policies for binary_search_tree, they keep per subtree data
+ *  up to date through insert, erase, rotations and bulk builds
+ *  - no_augment: nothing (default)
+ *  - order_statistics: subtree sizes, enables rank(), select() and
+ *    count_in_range() in O(log n)
+ *  - augment_both<A, B>: both A and B
+ *  - has_subtree_size<A>::value: A keeps order_statistics' subtree sizes
+ *
+ *  A policy provides:
+ *  - node_data<Key>: mixed into every node
+ *  - active: false skips all the bookkeeping
+ *  - update(n): recompute n's data from n->data and its kids, kids may be
+ *    NULL and are passed around as node_base, which carries node_data too
+ *
+ *  For example a sum of keys:
+ *
+ *  struct subtree_sum {
+ *  	template <typename _Key> struct node_data { _Key sum; };
+ *  	static const bool active = true;
+ *  	template <typename _Node> static void update(_Node* n) {
+ *  		n->sum = n->data;
+ *  		if (n->left()) n->sum += n->left()->sum;
+ *  		if (n->right()) n->sum += n->right()->sum;
+ *  	}
+ *  };
+ */
+
+#ifndef BST_AUGMENT_H_
+#define BST_AUGMENT_H_
+
+#include <cstddef>
+
+namespace yadslib {
+
+struct no_augment {
+	template <typename _Key>
+	struct node_data { };
+
+	static const bool active = false;
+
+	template <typename _Node>
+	static void update(_Node*) { }
+};
+
+struct order_statistics {
+	template <typename _Key>
+	struct node_data {
+		std::size_t subtree_size;
+	};
+
+	static const bool active = true;
+
+	template <typename _Node>
+	static std::size_t size(const _Node* pnode) { return pnode ? pnode->subtree_size : 0; }
+
+	template <typename _Node>
+	static void update(_Node* pnode) {
+		pnode->subtree_size = 1 + size(pnode->left()) + size(pnode->right());
+	}
+};
+
+template <typename _First, typename _Second>
+struct augment_both {
+	template <typename _Key>
+	struct node_data : _First::template node_data<_Key>, _Second::template node_data<_Key> { };
+
+	static const bool active = _First::active || _Second::active;
+
+	template <typename _Node>
+	static void update(_Node* pnode) {
+		_First::update(pnode);
+		_Second::update(pnode);
+	}
+};
+
+template <typename _Augment>
+struct has_subtree_size {
+	static const bool value = false;
+};
+
+template <>
+struct has_subtree_size<order_statistics> {
+	static const bool value = true;
+};
+
+template <typename _First, typename _Second>
+struct has_subtree_size<augment_both<_First, _Second> > {
+	static const bool value = has_subtree_size<_First>::value || has_subtree_size<_Second>::value;
+};
+
+}; // namespace
+
+#endif /* BST_AUGMENT_H_ */
@@ -0,0 +1,208 @@
+/*
+ * bst_balance.h
+ *
+ *  Balancing policies for binary_search_tree
+ *  - no_balance: plain BST, never rotates (default)
+ *  - avl_balance: AVL tree, keeps subtree heights
+ *  - rb_balance: red-black tree, keeps node colors
+ *
+ *  A policy provides:
+ *  - node_data: mixed into every node (empty for no_balance)
+ *  - init(n): called on every fresh node
+ *  - after_insert(n, ops): n was just linked as a leaf
+ *  - after_erase(removed, kid, parent, dir, ops): a node with at most one kid
+ *    was unlinked, kid took its place as parent->edge[dir] (parent is NULL
+ *    when kid became the root). removed carries the balance data of the
+ *    position that went away (see binary_search_tree::unlink_node)
+ *  - after_build(n, height, depth, tree_height): n belongs to a tree built
+ *    in one go with every leaf at depth tree_height - 1 or tree_height - 2,
+ *    n's subtree is height tall and n sits at depth (root is 0)
+ *
+ *  ops exposes the tree root (ops.root) and ops.rotate(n, dir), which
+ *  rotates n down to its dir side, its opposite kid takes n's place and is
+ *  returned.
+ */
+
+#ifndef BST_BALANCE_H_
+#define BST_BALANCE_H_
+
+#include <algorithm>
+#include <cstddef>
+
+namespace yadslib {
+
+struct no_balance {
+	struct node_data { };
+
+	template <typename _Node>
+	static void init(_Node*) { }
+
+	template <typename _Node, typename _Ops>
+	static void after_insert(_Node*, _Ops&) { }
+
+	template <typename _Node, typename _Ops>
+	static void after_erase(_Node*, _Node*, _Node*, int, _Ops&) { }
+
+	template <typename _Node>
+	static void after_build(_Node*, int, int, int) { }
+};
+
+struct avl_balance {
+	struct node_data {
+		int height; // leaves are 1
+	};
+
+	template <typename _Node>
+	static void init(_Node* pnode) { pnode->height = 1; }
+
+	template <typename _Node, typename _Ops>
+	static void after_insert(_Node* pnode, _Ops& ops) {
+		if (pnode != ops.root)
+			retrace(pnode->parent, ops);
+	}
+
+	template <typename _Node, typename _Ops>
+	static void after_erase(_Node*, _Node*, _Node* parent, int, _Ops& ops) {
+		if (parent)
+			retrace(parent, ops);
+	}
+
+	template <typename _Node>
+	static void after_build(_Node* pnode, int height, int, int) { pnode->height = height; }
+
+private:
+	template <typename _Node>
+	static int height(const _Node* pnode) { return pnode ? pnode->height : 0; }
+
+	template <typename _Node>
+	static void update(_Node* pnode) {
+		pnode->height = 1 + std::max(height(pnode->left()), height(pnode->right()));
+	}
+
+	template <typename _Node, typename _Ops>
+	static _Node* rotate(_Node* pnode, int dir, _Ops& ops) {
+		_Node* top = ops.rotate(pnode, dir);
+		update(pnode); // pnode is now below top
+		update(top);
+		return top;
+	}
+
+	// restore the AVL property at pnode, returns the subtree top
+	template <typename _Node, typename _Ops>
+	static _Node* fix(_Node* pnode, _Ops& ops) {
+		int lh = height(pnode->left());
+		int rh = height(pnode->right());
+		if (lh > rh + 1) {
+			_Node* l = pnode->left();
+			if (height(l->left()) < height(l->right()))
+				rotate(l, 0, ops); // left-right case
+			return rotate(pnode, 1, ops);
+		}
+		if (rh > lh + 1) {
+			_Node* r = pnode->right();
+			if (height(r->right()) < height(r->left()))
+				rotate(r, 1, ops); // right-left case
+			return rotate(pnode, 0, ops);
+		}
+		update(pnode);
+		return pnode;
+	}
+
+	// walk up fixing heights, stop as soon as a subtree keeps its old height
+	template <typename _Node, typename _Ops>
+	static void retrace(_Node* pnode, _Ops& ops) {
+		for (;;) {
+			int old_height = pnode->height;
+			pnode = fix(pnode, ops);
+			if (pnode->height == old_height || pnode == ops.root)
+				break;
+			pnode = pnode->parent;
+		}
+	}
+};
+
+struct rb_balance {
+	struct node_data {
+		bool red;
+	};
+
+	template <typename _Node>
+	static void init(_Node* pnode) { pnode->red = true; }
+
+	template <typename _Node, typename _Ops>
+	static void after_insert(_Node* x, _Ops& ops) {
+		while (x != ops.root && x->parent->red) {
+			_Node* p = x->parent;
+			_Node* g = p->parent; // p is red so it can't be the root
+			int d = (p == g->left()) ? 0 : 1;
+			_Node* u = g->edge[1 - d]; // uncle
+			if (is_red(u)) {
+				// push the blackness down from g
+				p->red = u->red = false;
+				g->red = true;
+				x = g;
+			} else {
+				if (x == p->edge[1 - d]) {
+					// inner grandchild, turn it into the outer one
+					x = p;
+					p = ops.rotate(x, d);
+				}
+				p->red = false;
+				g->red = true;
+				ops.rotate(g, 1 - d);
+				break;
+			}
+		}
+		ops.root->red = false;
+	}
+
+	template <typename _Node, typename _Ops>
+	static void after_erase(_Node* removed, _Node* x, _Node* x_parent, int dir, _Ops& ops) {
+		if (removed->red)
+			return; // black heights are untouched
+		while (x != ops.root && !is_red(x)) {
+			// x carries an extra black, x_parent is always valid here
+			int d = x ? ((x == x_parent->left()) ? 0 : 1) : dir;
+			_Node* w = x_parent->edge[1 - d]; // sibling, never null
+			if (w->red) {
+				w->red = false;
+				x_parent->red = true;
+				ops.rotate(x_parent, d);
+				w = x_parent->edge[1 - d];
+			}
+			if (!is_red(w->left()) && !is_red(w->right())) {
+				w->red = true;
+				x = x_parent;
+				x_parent = x->parent;
+			} else {
+				if (!is_red(w->edge[1 - d])) {
+					w->edge[d]->red = false;
+					w->red = true;
+					ops.rotate(w, 1 - d);
+					w = x_parent->edge[1 - d];
+				}
+				w->red = x_parent->red;
+				x_parent->red = false;
+				w->edge[1 - d]->red = false;
+				ops.rotate(x_parent, d);
+				x = ops.root;
+			}
+		}
+		if (x)
+			x->red = false;
+	}
+
+	// only the bottom level is red, so every path sees tree_height - 1 blacks
+	template <typename _Node>
+	static void after_build(_Node* pnode, int, int depth, int tree_height) {
+		pnode->red = (depth > 0 && depth == tree_height - 1);
+	}
+
+private:
+	template <typename _Node>
+	static bool is_red(const _Node* pnode) { return pnode && pnode->red; }
+};
+
+}; // namespace
+
+#endif /* BST_BALANCE_H_ */
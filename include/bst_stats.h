@@ -0,0 +1,57 @@
+/*
+ * bst_stats.h
+ *
+ *  Instrumentation policies for binary_search_tree
+ *  - no_stats: counts nothing, every hook is an empty inline (default)
+ *  - tree_stats: counts searches and the comparisons they make, rotations,
+ *    node allocations and deallocations
+ *
+ *  A policy provides the hooks compared(), searched(), rotated(),
+ *  allocated() and deallocated(n), the tree calls them from const lookups
+ *  too. Counters read through binary_search_tree::stats(), they are plain
+ *  integers: concurrent readers of one tree race on them, keep no_stats
+ *  there.
+ *
+ *  The shape queries (height(), depth_histogram(), average_path_length())
+ *  are members of the tree and work with any policy.
+ */
+
+#ifndef BST_STATS_H_
+#define BST_STATS_H_
+
+#include <cstddef>
+
+namespace yadslib {
+
+struct no_stats {
+	void compared() { }
+	void searched() { }
+	void rotated() { }
+	void allocated() { }
+	void deallocated(std::size_t = 1) { }
+};
+
+struct tree_stats {
+	std::size_t comparisons; // key comparisons made by searches
+	std::size_t searches; // descents from the root: finds, bounds, inserts
+	std::size_t rotations;
+	std::size_t allocations; // nodes
+	std::size_t deallocations;
+
+	tree_stats() { reset(); }
+
+	void reset() { comparisons = searches = rotations = allocations = deallocations = 0; }
+
+	void compared() { ++comparisons; }
+	void searched() { ++searches; }
+	void rotated() { ++rotations; }
+	void allocated() { ++allocations; }
+	void deallocated(std::size_t n = 1) { deallocations += n; }
+
+	// the descents run down to a leaf, a bit over the tree's average_path_length()
+	double comparisons_per_search() const { return searches ? double(comparisons) / searches : 0; }
+};
+
+}; // namespace
+
+#endif /* BST_STATS_H_ */
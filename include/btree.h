@@ -0,0 +1,649 @@
+/*
+ * btree.h
+ *
+ *  B+ tree with
+ *  - many keys per node, node size is a whole number of cache lines
+ *  - keys only in the leaves, leaves doubly linked for ordered scans
+ *  - no duplicates (acts like a set), same interface as binary_search_tree
+ *
+ *  Fanout comes from the key size: a node takes _NodeLines cache lines and
+ *  holds as many keys (and child pointers for inner nodes) as fit. For 8 byte
+ *  keys and the default 4 lines that is 29 keys per leaf instead of one key
+ *  and three pointers per binary_search_tree node.
+ *
+ *  Inserting or erasing moves keys around inside nodes, so unlike
+ *  binary_search_tree it invalidates iterators.
+ */
+
+#ifndef BTREE_H_
+#define BTREE_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "traits.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key>,
+	typename _Alloc = std::allocator<_Key>, std::size_t _NodeLines = 4>
+class b_plus_tree {
+public:
+	static const std::size_t cache_line_size = 64;
+
+private:
+	enum { node_bytes = _NodeLines * cache_line_size };
+
+	struct node {
+		unsigned short count; // keys held
+		bool leaf;
+	};
+
+	struct leaf_node;
+
+	struct leaf_links : node {
+		leaf_node* prev;
+		leaf_node* next;
+	};
+
+	// never less than 4 keys per node, even for huge keys
+	enum {
+		leaf_fit = (node_bytes - sizeof(leaf_links)) / sizeof(_Key),
+		leaf_slots = leaf_fit < 4 ? 4 : leaf_fit,
+		inner_fit = (node_bytes - sizeof(node) - sizeof(void*)) / (sizeof(_Key) + sizeof(void*)),
+		inner_slots = inner_fit < 4 ? 4 : inner_fit,
+		// below these a node borrows from or merges with a sibling
+		leaf_min = leaf_slots / 2,
+		inner_min = inner_slots / 2
+	};
+
+	struct leaf_node : leaf_links {
+		detail::uninitialized_array<_Key, leaf_slots> keys;
+	};
+
+	/* keys[i] separates child[i] (all keys less) from child[i + 1]
+	 (all keys greater or equal) */
+	struct inner_node : node {
+		detail::uninitialized_array<_Key, inner_slots> keys;
+		node* child[inner_slots + 1];
+	};
+
+	static leaf_node* as_leaf(node* n) { return static_cast<leaf_node*>(n); }
+	static inner_node* as_inner(node* n) { return static_cast<inner_node*>(n); }
+
+public:
+	typedef _Alloc allocator_type;
+	typedef typename _Alloc::value_type value_type;
+	typedef typename _Alloc::reference reference;
+	typedef typename _Alloc::const_reference const_reference;
+	typedef typename _Alloc::pointer pointer;
+	typedef typename _Alloc::const_pointer const_pointer;
+	typedef typename _Alloc::size_type size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	static const std::size_t keys_per_leaf = leaf_slots;
+	static const std::size_t keys_per_inner = inner_slots;
+
+	// a leaf and a slot in it, end() has no leaf
+	class iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : tree(NULL), lf(NULL), idx(0) { }
+		bool operator==(const iterator& other) const { return lf == other.lf && idx == other.idx; }
+		bool operator!=(const iterator& other) const { return !(*this == other); }
+		iterator& operator++() {
+			if (++idx == lf->count) {
+				lf = lf->next;
+				idx = 0;
+			}
+			return *this;
+		}
+		iterator& operator--() {
+			if (lf == NULL) {
+				lf = tree->tail; // end() - 1
+				idx = lf->count - 1;
+			} else if (idx == 0) {
+				lf = lf->prev;
+				idx = lf->count - 1;
+			} else {
+				--idx;
+			}
+			return *this;
+		}
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		iterator operator--(int) { iterator tmp(*this); --*this; return tmp; }
+		reference operator*() const { return lf->keys.data()[idx]; }
+		pointer operator->() const { return lf->keys.data() + idx; }
+	private:
+		friend class b_plus_tree;
+		iterator(const b_plus_tree* _tree, leaf_node* _lf, std::size_t _idx) : tree(_tree), lf(_lf), idx(_idx) { }
+		const b_plus_tree* tree;
+		leaf_node* lf;
+		std::size_t idx;
+	};
+
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	explicit b_plus_tree(const _Compare& comp = _Compare())
+		: root(NULL), head(NULL), tail(NULL), m_size(0), m_comp(comp) { }
+
+	b_plus_tree(const b_plus_tree& other)
+		: root(NULL), head(NULL), tail(NULL), m_size(0), m_comp(other.m_comp) {
+		insert(other.begin(), other.end());
+	}
+
+	~b_plus_tree() { clear(); }
+
+	b_plus_tree& operator=(const b_plus_tree& other) {
+		if (this != &other) {
+			b_plus_tree tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+#if __cplusplus >= 201103L
+	b_plus_tree(b_plus_tree&& other)
+		: root(NULL), head(NULL), tail(NULL), m_size(0), m_comp(other.m_comp) {
+		swap(other);
+	}
+
+	b_plus_tree& operator=(b_plus_tree&& other) {
+		if (this != &other) {
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+#endif
+
+	void swap(b_plus_tree& other) {
+		using std::swap;
+		swap(root, other.root);
+		swap(head, other.head);
+		swap(tail, other.tail);
+		swap(m_size, other.m_size);
+		swap(m_comp, other.m_comp);
+		swap(leaf_alloc, other.leaf_alloc);
+		swap(inner_alloc, other.inner_alloc);
+	}
+
+	size_t size() const { return m_size; }
+
+	bool empty() const { return m_size == 0; }
+
+	key_compare key_comp() const { return m_comp; }
+
+	void clear() {
+		if (root)
+			destroy_subtree(root);
+		root = NULL;
+		head = tail = NULL;
+		m_size = 0;
+	}
+
+	std::pair<iterator, bool> insert(const_reference x) {
+		if (root == NULL) {
+			head = tail = new_leaf();
+			root = head;
+		}
+		split_result split;
+		leaf_node* lf;
+		std::size_t idx;
+		bool inserted = insert_rec(root, x, lf, idx, split);
+		if (split.right) {
+			// the root split, grow a level
+			inner_node* nr = new_inner();
+			nr->child[0] = root;
+			nr->child[1] = split.right;
+			::new (static_cast<void*>(nr->keys.data())) _Key(detail::move(*split.key.data()));
+			split.key.data()->~_Key();
+			nr->count = 1;
+			root = nr;
+		}
+		if (inserted)
+			++m_size;
+		return std::make_pair(iterator(this, lf, idx), inserted);
+	}
+
+	template<typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_t erase(const_reference x) {
+		if (root == NULL || !erase_rec(root, x))
+			return 0;
+		--m_size;
+		if (root->count == 0) {
+			// shrink a level (or drop the last leaf)
+			node* old = root;
+			if (old->leaf) {
+				root = NULL;
+				head = tail = NULL;
+				leaf_alloc.deallocate(as_leaf(old), 1);
+			} else {
+				root = as_inner(old)->child[0];
+				inner_alloc.deallocate(as_inner(old), 1);
+			}
+		}
+		return 1;
+	}
+
+	template<typename _InputIterator>
+	void erase(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			erase(*first);
+	}
+
+	size_t count(const_reference x) const { return find(x) != end() ? 1 : 0; }
+
+	iterator find(const_reference x) const { return find_impl(x); }
+
+	iterator lower_bound(const_reference x) const { return lower_bound_impl(x); }
+
+	iterator upper_bound(const_reference x) const { return upper_bound_impl(x); }
+
+	std::pair<iterator, iterator> equal_range(const_reference x) const {
+		return std::make_pair(lower_bound(x), upper_bound(x));
+	}
+
+	// heterogeneous lookup, only with a transparent comparator (std::less<>)
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, size_t>::type count(const _Lookup& x) const {
+		return find_impl(x) != end() ? 1 : 0;
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type find(const _Lookup& x) const {
+		return find_impl(x);
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type lower_bound(const _Lookup& x) const {
+		return lower_bound_impl(x);
+	}
+
+	template <typename _Lookup>
+	typename detail::enable_transparent<_Compare, _Lookup, iterator>::type upper_bound(const _Lookup& x) const {
+		return upper_bound_impl(x);
+	}
+
+	iterator begin() const { return iterator(this, head, 0); }
+	iterator end() const { return iterator(this, NULL, 0); }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return head->keys.data()[0]; }
+
+	const_reference max() const { return tail->keys.data()[tail->count - 1]; }
+
+private:
+	node* root;
+	leaf_node* head; // left most leaf
+	leaf_node* tail; // right most leaf
+
+	size_t m_size;
+
+	_Compare m_comp;
+
+	typename allocator_type::template rebind<leaf_node>::other leaf_alloc;
+	typename allocator_type::template rebind<inner_node>::other inner_alloc;
+
+	// a node that split hands its new right sibling and separator up
+	struct split_result {
+		node* right; // NULL if there was no split
+		detail::uninitialized_array<_Key, 1> key; // constructed if right is set
+		split_result() : right(NULL) { }
+	};
+
+	leaf_node* new_leaf() {
+		leaf_node* n = leaf_alloc.allocate(1);
+		n->count = 0;
+		n->leaf = true;
+		n->prev = n->next = NULL;
+		return n;
+	}
+
+	inner_node* new_inner() {
+		inner_node* n = inner_alloc.allocate(1);
+		n->count = 0;
+		n->leaf = false;
+		return n;
+	}
+
+	void destroy_subtree(node* n) {
+		if (n->leaf) {
+			destroy_keys(as_leaf(n)->keys.data(), n->count);
+			leaf_alloc.deallocate(as_leaf(n), 1);
+		} else {
+			inner_node* in = as_inner(n);
+			for (std::size_t i = 0; i <= in->count; ++i)
+				destroy_subtree(in->child[i]);
+			destroy_keys(in->keys.data(), in->count);
+			inner_alloc.deallocate(in, 1);
+		}
+	}
+
+	/* key array helpers, keys [0, count) are constructed */
+
+	static void destroy_keys(_Key* keys, std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i)
+			keys[i].~_Key();
+	}
+
+	// open a gap at pos and put x there
+	static void insert_key(_Key* keys, unsigned short& count, std::size_t pos, const _Key& x) {
+		if (pos == count) {
+			::new (static_cast<void*>(keys + count)) _Key(x);
+		} else {
+			::new (static_cast<void*>(keys + count)) _Key(detail::move(keys[count - 1]));
+			for (std::size_t j = count - 1; j > pos; --j)
+				keys[j] = detail::move(keys[j - 1]);
+			keys[pos] = x;
+		}
+		++count;
+	}
+
+	// close the gap at pos
+	static void erase_key(_Key* keys, unsigned short& count, std::size_t pos) {
+		for (std::size_t j = pos; j + 1 < count; ++j)
+			keys[j] = detail::move(keys[j + 1]);
+		keys[--count].~_Key();
+	}
+
+	// move n keys into uninitialized dst, src is left uninitialized
+	static void move_keys(_Key* dst, _Key* src, std::size_t n) {
+		for (std::size_t i = 0; i < n; ++i) {
+			::new (static_cast<void*>(dst + i)) _Key(detail::move(src[i]));
+			src[i].~_Key();
+		}
+	}
+
+	// which child of an inner node may hold x
+	template <typename _Lookup>
+	std::size_t child_index(const inner_node* n, const _Lookup& x) const {
+		const _Key* keys = n->keys.data();
+		return std::upper_bound(keys, keys + n->count, x, m_comp) - keys;
+	}
+
+	// leaf that may hold x
+	template <typename _Lookup>
+	leaf_node* find_leaf(const _Lookup& x) const {
+		node* n = root;
+		while (!n->leaf)
+			n = as_inner(n)->child[child_index(as_inner(n), x)];
+		return as_leaf(n);
+	}
+
+	// normalize an iterator that points one past a leaf's last key
+	iterator make_iterator(leaf_node* lf, std::size_t idx) const {
+		if (idx == lf->count)
+			return iterator(this, lf->next, 0);
+		return iterator(this, lf, idx);
+	}
+
+	template <typename _Lookup>
+	iterator lower_bound_impl(const _Lookup& x) const {
+		if (root == NULL)
+			return end();
+		leaf_node* lf = find_leaf(x);
+		const _Key* keys = lf->keys.data();
+		return make_iterator(lf, std::lower_bound(keys, keys + lf->count, x, m_comp) - keys);
+	}
+
+	template <typename _Lookup>
+	iterator upper_bound_impl(const _Lookup& x) const {
+		if (root == NULL)
+			return end();
+		leaf_node* lf = find_leaf(x);
+		const _Key* keys = lf->keys.data();
+		return make_iterator(lf, std::upper_bound(keys, keys + lf->count, x, m_comp) - keys);
+	}
+
+	template <typename _Lookup>
+	iterator find_impl(const _Lookup& x) const {
+		iterator it = lower_bound_impl(x);
+		if (it != end() && !m_comp(x, *it))
+			return it;
+		return end();
+	}
+
+	/* insert x below n, lf/idx get where x (or its equal) ends up. If n had
+	 to split, split gets the new right sibling and the separator for it */
+	bool insert_rec(node* n, const _Key& x, leaf_node*& lf, std::size_t& idx, split_result& split) {
+		if (n->leaf) {
+			leaf_node* l = as_leaf(n);
+			_Key* keys = l->keys.data();
+			std::size_t pos = std::lower_bound(keys, keys + l->count, x, m_comp) - keys;
+			if (pos < l->count && !m_comp(x, keys[pos])) {
+				lf = l;
+				idx = pos;
+				return false; // already there
+			}
+			if (l->count < leaf_slots) {
+				insert_key(keys, l->count, pos, x);
+				lf = l;
+				idx = pos;
+				return true;
+			}
+			// full, move the upper half to a new right sibling
+			leaf_node* r = new_leaf();
+			std::size_t mid = (leaf_slots + 1) / 2; // keys left keeps, x included
+			std::size_t keep = pos < mid ? mid - 1 : mid;
+			move_keys(r->keys.data(), keys + keep, l->count - keep);
+			r->count = l->count - keep;
+			l->count = keep;
+			if (pos < mid) {
+				insert_key(keys, l->count, pos, x);
+				lf = l;
+				idx = pos;
+			} else {
+				insert_key(r->keys.data(), r->count, pos - mid, x);
+				lf = r;
+				idx = pos - mid;
+			}
+			r->prev = l;
+			r->next = l->next;
+			if (l->next)
+				l->next->prev = r;
+			else
+				tail = r;
+			l->next = r;
+			split.right = r;
+			::new (static_cast<void*>(split.key.data())) _Key(r->keys.data()[0]);
+			return true;
+		}
+		inner_node* in = as_inner(n);
+		std::size_t i = child_index(in, x);
+		split_result below;
+		bool inserted = insert_rec(in->child[i], x, lf, idx, below);
+		if (below.right) {
+			insert_child(in, i, below, split);
+			below.key.data()->~_Key();
+		}
+		return inserted;
+	}
+
+	/* hang below.right (with separator below.key) right of child i,
+	 splitting in if it is full: the middle separator then moves up */
+	void insert_child(inner_node* in, std::size_t i, split_result& below, split_result& split) {
+		const _Key& sep = *below.key.data();
+		if (in->count < inner_slots) {
+			insert_key(in->keys.data(), in->count, i, sep);
+			for (std::size_t j = in->count; j > i + 1; --j)
+				in->child[j] = in->child[j - 1];
+			in->child[i + 1] = below.right;
+			return;
+		}
+		inner_node* r = new_inner();
+		_Key* keys = in->keys.data();
+		std::size_t mid = (inner_slots + 1) / 2; // position of the key that moves up
+		if (i == mid) {
+			// the new separator itself moves up
+			::new (static_cast<void*>(split.key.data())) _Key(sep);
+			move_keys(r->keys.data(), keys + mid, inner_slots - mid);
+			r->child[0] = below.right;
+			for (std::size_t j = mid + 1; j <= inner_slots; ++j)
+				r->child[j - mid] = in->child[j];
+			r->count = inner_slots - mid;
+			in->count = mid;
+		} else if (i < mid) {
+			// keys[mid - 1] moves up, the new one goes left
+			::new (static_cast<void*>(split.key.data())) _Key(detail::move(keys[mid - 1]));
+			keys[mid - 1].~_Key();
+			move_keys(r->keys.data(), keys + mid, inner_slots - mid);
+			for (std::size_t j = mid; j <= inner_slots; ++j)
+				r->child[j - mid] = in->child[j];
+			r->count = inner_slots - mid;
+			in->count = mid - 1;
+			insert_key(keys, in->count, i, sep);
+			for (std::size_t j = in->count; j > i + 1; --j)
+				in->child[j] = in->child[j - 1];
+			in->child[i + 1] = below.right;
+		} else {
+			// keys[mid] moves up, the new one goes right
+			::new (static_cast<void*>(split.key.data())) _Key(detail::move(keys[mid]));
+			keys[mid].~_Key();
+			move_keys(r->keys.data(), keys + mid + 1, inner_slots - mid - 1);
+			for (std::size_t j = mid + 1; j <= inner_slots; ++j)
+				r->child[j - mid - 1] = in->child[j];
+			r->count = inner_slots - mid - 1;
+			in->count = mid;
+			std::size_t ri = i - mid - 1;
+			insert_key(r->keys.data(), r->count, ri, sep);
+			for (std::size_t j = r->count; j > ri + 1; --j)
+				r->child[j] = r->child[j - 1];
+			r->child[ri + 1] = below.right;
+		}
+		split.right = r;
+	}
+
+	// erase x below n, the caller fixes n if it ends up too small
+	template <typename _Lookup>
+	bool erase_rec(node* n, const _Lookup& x) {
+		if (n->leaf) {
+			leaf_node* l = as_leaf(n);
+			_Key* keys = l->keys.data();
+			std::size_t pos = std::lower_bound(keys, keys + l->count, x, m_comp) - keys;
+			if (pos == l->count || m_comp(x, keys[pos]))
+				return false;
+			erase_key(keys, l->count, pos);
+			return true;
+		}
+		inner_node* in = as_inner(n);
+		std::size_t i = child_index(in, x);
+		if (!erase_rec(in->child[i], x))
+			return false;
+		node* c = in->child[i];
+		if (c->count < (c->leaf ? (std::size_t)leaf_min : (std::size_t)inner_min))
+			fix_child(in, i);
+		return true;
+	}
+
+	// child i of p is too small, borrow a key from a sibling or merge with it
+	void fix_child(inner_node* p, std::size_t i) {
+		std::size_t min_keys = p->child[i]->leaf ? leaf_min : inner_min;
+		if (i < p->count && p->child[i + 1]->count > min_keys)
+			borrow_from_right(p, i);
+		else if (i > 0 && p->child[i - 1]->count > min_keys)
+			borrow_from_left(p, i);
+		else if (i < p->count)
+			merge_children(p, i);
+		else
+			merge_children(p, i - 1);
+	}
+
+	void borrow_from_right(inner_node* p, std::size_t i) {
+		_Key* sep = p->keys.data() + i;
+		if (p->child[i]->leaf) {
+			leaf_node* c = as_leaf(p->child[i]);
+			leaf_node* r = as_leaf(p->child[i + 1]);
+			insert_key(c->keys.data(), c->count, c->count, r->keys.data()[0]);
+			erase_key(r->keys.data(), r->count, 0);
+			*sep = r->keys.data()[0];
+		} else {
+			// rotate through the parent
+			inner_node* c = as_inner(p->child[i]);
+			inner_node* r = as_inner(p->child[i + 1]);
+			insert_key(c->keys.data(), c->count, c->count, *sep);
+			c->child[c->count] = r->child[0];
+			*sep = r->keys.data()[0];
+			erase_key(r->keys.data(), r->count, 0);
+			for (std::size_t j = 0; j <= r->count; ++j)
+				r->child[j] = r->child[j + 1];
+		}
+	}
+
+	void borrow_from_left(inner_node* p, std::size_t i) {
+		_Key* sep = p->keys.data() + i - 1;
+		if (p->child[i]->leaf) {
+			leaf_node* l = as_leaf(p->child[i - 1]);
+			leaf_node* c = as_leaf(p->child[i]);
+			insert_key(c->keys.data(), c->count, 0, l->keys.data()[l->count - 1]);
+			erase_key(l->keys.data(), l->count, l->count - 1);
+			*sep = c->keys.data()[0];
+		} else {
+			inner_node* l = as_inner(p->child[i - 1]);
+			inner_node* c = as_inner(p->child[i]);
+			insert_key(c->keys.data(), c->count, 0, *sep);
+			for (std::size_t j = c->count; j > 0; --j)
+				c->child[j] = c->child[j - 1];
+			c->child[0] = l->child[l->count];
+			*sep = l->keys.data()[l->count - 1];
+			erase_key(l->keys.data(), l->count, l->count - 1);
+		}
+	}
+
+	// fold child i + 1 of p into child i
+	void merge_children(inner_node* p, std::size_t i) {
+		if (p->child[i]->leaf) {
+			leaf_node* l = as_leaf(p->child[i]);
+			leaf_node* r = as_leaf(p->child[i + 1]);
+			move_keys(l->keys.data() + l->count, r->keys.data(), r->count);
+			l->count += r->count;
+			l->next = r->next;
+			if (r->next)
+				r->next->prev = l;
+			else
+				tail = l;
+			leaf_alloc.deallocate(r, 1);
+		} else {
+			// the separator comes down between both halves
+			inner_node* l = as_inner(p->child[i]);
+			inner_node* r = as_inner(p->child[i + 1]);
+			insert_key(l->keys.data(), l->count, l->count, p->keys.data()[i]);
+			move_keys(l->keys.data() + l->count, r->keys.data(), r->count);
+			for (std::size_t j = 0; j <= r->count; ++j)
+				l->child[l->count + j] = r->child[j];
+			l->count += r->count;
+			inner_alloc.deallocate(r, 1);
+		}
+		erase_key(p->keys.data(), p->count, i);
+		for (std::size_t j = i + 1; j <= p->count; ++j)
+			p->child[j] = p->child[j + 1];
+	}
+};
+
+template <typename _Key, typename _Compare, typename _Alloc, std::size_t _NodeLines>
+inline void swap(b_plus_tree<_Key, _Compare, _Alloc, _NodeLines>& a,
+		b_plus_tree<_Key, _Compare, _Alloc, _NodeLines>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* BTREE_H_ */
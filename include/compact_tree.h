@@ -0,0 +1,641 @@
+/*
+ * compact_tree.h
+ *
+ *  Compact balanced search tree for many small keys, with
+ *  - no parent pointers: nodes hold two child links and the key
+ *  - links are _Index sized node numbers (32 bits by default) into the
+ *    tree's own chunked node pool, the red bit lives in the top bit of the
+ *    left link: 12 bytes per int key instead of 32 in binary_search_tree,
+ *    plus no per node allocator overhead
+ *  - left-leaning red-black balancing (Sedgewick), insert and erase go top
+ *    down recursively and fix the path on the way back
+ *  - stack based bidirectional iterators, they carry the path from the root
+ *  - no duplicates (acts like a set), same interface as binary_search_tree
+ *
+ *  Iterators hold a path, so any insert or erase invalidates all of them.
+ *  At most 2^(bits of _Index - 1) - 1 keys.
+ */
+
+#ifndef COMPACT_TREE_H_
+#define COMPACT_TREE_H_
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "traits.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key>,
+	typename _Alloc = std::allocator<_Key>, typename _Index = unsigned int>
+class compact_tree {
+	struct node {
+		_Index link[2]; // free nodes chain through link[1]
+		_Key data;
+	};
+
+	enum {
+		chunk_shift = 10, // nodes per chunk, as a power of two
+		chunk_nodes = 1 << chunk_shift,
+		max_depth = 2 * sizeof(_Index) * 8 // red-black height bound
+	};
+
+	static const _Index nil = 0; // node 0 is never handed out
+	static const _Index red_bit = static_cast<_Index>(1) << (sizeof(_Index) * 8 - 1);
+
+public:
+	typedef _Alloc allocator_type;
+	typedef typename _Alloc::value_type value_type;
+	typedef typename _Alloc::reference reference;
+	typedef typename _Alloc::const_reference const_reference;
+	typedef typename _Alloc::pointer pointer;
+	typedef typename _Alloc::const_pointer const_pointer;
+	typedef typename _Alloc::size_type size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+	typedef _Index index_type;
+
+	static const std::size_t node_bytes = sizeof(node);
+
+	// the path from the root to the current node, end() has none
+	class iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : tree(NULL), depth(0) { }
+		bool operator==(const iterator& other) const { return current() == other.current(); }
+		bool operator!=(const iterator& other) const { return current() != other.current(); }
+		iterator& operator++() { step(1); return *this; }
+		iterator& operator--() { step(0); return *this; }
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		iterator operator--(int) { iterator tmp(*this); --*this; return tmp; }
+		reference operator*() const { return tree->key(current()); }
+		pointer operator->() const { return &tree->key(current()); }
+	private:
+		friend class compact_tree;
+		explicit iterator(const compact_tree* _tree) : tree(_tree), depth(0) { }
+
+		_Index current() const { return depth ? path[depth - 1] : nil; }
+
+		void push_extreme(_Index n, int dir) {
+			for (; n != nil; n = tree->kid(n, dir))
+				path[depth++] = n;
+		}
+
+		// in order successor for dir 1, predecessor for dir 0
+		void step(int dir) {
+			if (depth == 0) {
+				push_extreme(tree->m_root, !dir); // --end() is the maximum
+				return;
+			}
+			_Index n = tree->kid(path[depth - 1], dir);
+			if (n != nil) {
+				path[depth++] = n;
+				push_extreme(tree->kid(n, !dir), !dir);
+				return;
+			}
+			// climb while we come from the dir side
+			_Index c;
+			do {
+				c = path[--depth];
+			} while (depth > 0 && tree->kid(path[depth - 1], dir) == c);
+		}
+
+		const compact_tree* tree;
+		unsigned depth;
+		_Index path[max_depth];
+	};
+
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	explicit compact_tree(const _Compare& comp = _Compare())
+		: m_root(nil), m_size(0), fresh(1), free_list(nil), m_comp(comp) { }
+
+	// deep copy, every key keeps its node number
+	compact_tree(const compact_tree& other)
+		: m_root(nil), m_size(0), fresh(1), free_list(nil), m_comp(other.m_comp) {
+		chunks.reserve(other.chunks.size()); // push_back cannot throw then
+		try {
+			// nodes from other.fresh on were never written, the free list is below it
+			for (size_type i = 0; i < other.chunks.size(); ++i) {
+				chunks.push_back(node_alloc.allocate(chunk_nodes));
+				size_type first = i * chunk_nodes;
+				size_type used = other.fresh - first < chunk_nodes ? other.fresh - first : chunk_nodes;
+				for (size_type j = 0; j < used; ++j) {
+					chunks[i][j].link[0] = other.chunks[i][j].link[0];
+					chunks[i][j].link[1] = other.chunks[i][j].link[1];
+				}
+			}
+			copy_keys(other, other.m_root);
+		} catch (...) {
+			// m_root is still nil, the keys copied so far are the first in order
+			size_type copied = m_size;
+			destroy_keys(other.m_root, copied);
+			clear();
+			throw;
+		}
+		m_root = other.m_root;
+		fresh = other.fresh;
+		free_list = other.free_list;
+	}
+
+	~compact_tree() { clear(); }
+
+	compact_tree& operator=(const compact_tree& other) {
+		if (this != &other) {
+			compact_tree tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+#if __cplusplus >= 201103L
+	compact_tree(compact_tree&& other)
+		: m_root(nil), m_size(0), fresh(1), free_list(nil), m_comp(other.m_comp) {
+		swap(other);
+	}
+
+	compact_tree& operator=(compact_tree&& other) {
+		if (this != &other) {
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+#endif
+
+	void swap(compact_tree& other) {
+		using std::swap;
+		swap(m_root, other.m_root);
+		swap(m_size, other.m_size);
+		swap(fresh, other.fresh);
+		swap(free_list, other.free_list);
+		swap(m_comp, other.m_comp);
+		chunks.swap(other.chunks);
+		swap(node_alloc, other.node_alloc);
+	}
+
+	size_t size() const { return m_size; }
+
+	bool empty() const { return m_size == 0; }
+
+	key_compare key_comp() const { return m_comp; }
+
+	// bytes held by the node pool
+	size_t memory_usage() const { return chunks.size() * chunk_nodes * sizeof(node); }
+
+	// O(chunks) when keys need no destructor
+	void clear() {
+		if (!detail::is_trivially_destructible<_Key>::value)
+			destroy_keys(m_root);
+		for (size_type i = 0; i < chunks.size(); ++i)
+			node_alloc.deallocate(chunks[i], chunk_nodes);
+		chunks.clear();
+		m_root = nil;
+		m_size = 0;
+		fresh = 1;
+		free_list = nil;
+	}
+
+	// one descent, the iterator comes from its path
+	std::pair<iterator, bool> insert(const_reference x) {
+		bool inserted = false;
+		trail t;
+		m_root = insert_node(m_root, x, inserted, t);
+		set_red(m_root, false);
+		return std::make_pair(iterator_at(t), inserted);
+	}
+
+#if __cplusplus >= 201103L
+	// x is moved from only if it goes in
+	std::pair<iterator, bool> insert(value_type&& x) {
+		bool inserted = false;
+		trail t;
+		m_root = insert_node(m_root, x, inserted, t);
+		set_red(m_root, false);
+		return std::make_pair(iterator_at(t), inserted);
+	}
+
+	template <typename... _Args>
+	std::pair<iterator, bool> emplace(_Args&&... args) {
+		_Index n = create_node(std::forward<_Args>(args)...);
+		bool inserted = false;
+		trail t;
+		m_root = link_node(m_root, n, inserted, t);
+		set_red(m_root, false);
+		if (!inserted)
+			free_node(n);
+		return std::make_pair(iterator_at(t), inserted);
+	}
+#endif
+
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_t erase(const_reference x) {
+		if (!count(x))
+			return 0;
+		if (!is_red(left(m_root)) && !is_red(right(m_root)))
+			set_red(m_root, true);
+		m_root = erase_node(m_root, x);
+		set_red(m_root, false);
+		return 1;
+	}
+
+	size_t count(const_reference x) const {
+		_Index n = lower_bound_node(x);
+		return (n != nil && !m_comp(x, key(n))) ? 1 : 0;
+	}
+
+	iterator find(const_reference x) const {
+		iterator it = lower_bound(x);
+		return (it.depth && !m_comp(x, *it)) ? it : end();
+	}
+
+	// first key not less than x
+	iterator lower_bound(const_reference x) const {
+		iterator it(this);
+		unsigned ge_depth = 0; // path length down to the last node not less than x
+		for (_Index n = m_root; n != nil; ) {
+			it.path[it.depth++] = n;
+			if (m_comp(key(n), x)) {
+				n = right(n);
+			} else {
+				ge_depth = it.depth;
+				n = left(n);
+			}
+		}
+		it.depth = ge_depth;
+		return it;
+	}
+
+	// first key greater than x
+	iterator upper_bound(const_reference x) const {
+		iterator it(this);
+		unsigned gt_depth = 0;
+		for (_Index n = m_root; n != nil; ) {
+			it.path[it.depth++] = n;
+			if (m_comp(x, key(n))) {
+				gt_depth = it.depth;
+				n = left(n);
+			} else {
+				n = right(n);
+			}
+		}
+		it.depth = gt_depth;
+		return it;
+	}
+
+	iterator begin() const {
+		iterator it(this);
+		it.push_extreme(m_root, 0);
+		return it;
+	}
+
+	iterator end() const { return iterator(this); }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return *begin(); }
+	const_reference max() const { return *--end(); }
+
+private:
+	_Index m_root;
+	size_t m_size;
+	_Index fresh; // first node number never handed out
+	_Index free_list;
+	_Compare m_comp;
+
+	typedef typename _Alloc::template rebind<node>::other node_allocator;
+	node_allocator node_alloc;
+	std::vector<node*> chunks;
+
+	node& at(_Index n) const { return chunks[n >> chunk_shift][n & (chunk_nodes - 1)]; }
+	const _Key& key(_Index n) const { return at(n).data; }
+
+	_Index kid(_Index n, int dir) const { return at(n).link[dir] & ~red_bit; }
+	_Index left(_Index n) const { return kid(n, 0); }
+	_Index right(_Index n) const { return at(n).link[1]; }
+	void set_left(_Index n, _Index l) { at(n).link[0] = (at(n).link[0] & red_bit) | l; }
+	void set_right(_Index n, _Index r) { at(n).link[1] = r; }
+
+	bool is_red(_Index n) const { return n != nil && (at(n).link[0] & red_bit); }
+	void set_red(_Index n, bool red) {
+		if (n != nil)
+			at(n).link[0] = red ? (at(n).link[0] | red_bit) : (at(n).link[0] & ~red_bit);
+	}
+
+	/* the path from the root of a subtree down to one node, bottom up so
+	 that it can grow as the subtree does. Rotations keep it up to date */
+	struct trail {
+		_Index up[max_depth]; // up[0] the node, up[size - 1] the subtree root
+		unsigned size;
+
+		void start(_Index n) {
+			up[0] = n;
+			size = 1;
+		}
+
+		void push(_Index n) { up[size++] = n; }
+
+		// the root t rotates: its kid x goes up, x's kid inner goes over to t
+		void rotated(_Index t, _Index x, _Index inner) {
+			if (size >= 2 && up[size - 2] == x) {
+				--size; // t leaves the path unless it is now above inner
+				if (size >= 2 && up[size - 2] == inner) {
+					up[size - 1] = t;
+					up[size++] = x;
+				}
+			} else {
+				up[size++] = x;
+			}
+		}
+	};
+
+	iterator iterator_at(const trail& t) const {
+		iterator it(this);
+		for (unsigned i = t.size; i > 0; --i)
+			it.path[it.depth++] = t.up[i - 1];
+		return it;
+	}
+
+	_Index rotate_left(_Index h, trail* t = NULL) {
+		_Index x = right(h);
+		if (t)
+			t->rotated(h, x, left(x));
+		set_right(h, left(x));
+		set_left(x, h);
+		set_red(x, is_red(h));
+		set_red(h, true);
+		return x;
+	}
+
+	_Index rotate_right(_Index h, trail* t = NULL) {
+		_Index x = left(h);
+		if (t)
+			t->rotated(h, x, right(x));
+		set_left(h, right(x));
+		set_right(x, h);
+		set_red(x, is_red(h));
+		set_red(h, true);
+		return x;
+	}
+
+	void flip_colors(_Index h) {
+		set_red(h, !is_red(h));
+		set_red(left(h), !is_red(left(h)));
+		set_red(right(h), !is_red(right(h)));
+	}
+
+	// restores the left leaning invariants at h on the way up, t follows if given
+	_Index fix_up(_Index h, trail* t = NULL) {
+		if (is_red(right(h)) && !is_red(left(h)))
+			h = rotate_left(h, t);
+		if (is_red(left(h)) && is_red(left(left(h))))
+			h = rotate_right(h, t);
+		if (is_red(left(h)) && is_red(right(h)))
+			flip_colors(h);
+		return h;
+	}
+
+	_Index move_red_left(_Index h) {
+		flip_colors(h);
+		if (is_red(left(right(h)))) {
+			set_right(h, rotate_right(right(h)));
+			h = rotate_left(h);
+			flip_colors(h);
+		}
+		return h;
+	}
+
+	_Index move_red_right(_Index h) {
+		flip_colors(h);
+		if (is_red(left(left(h)))) {
+			h = rotate_right(h);
+			flip_colors(h);
+		}
+		return h;
+	}
+
+	/* adds a new red node for x unless it is there already, t ends up as
+	 the path to x's node. A non const x is moved into the new node */
+	template <typename _Source>
+	_Index insert_node(_Index h, _Source& x, bool& inserted, trail& t) {
+		if (h == nil) {
+			inserted = true;
+			_Index n = create_node(detail::move(x));
+			t.start(n);
+			return n;
+		}
+		if (m_comp(x, key(h))) {
+			set_left(h, insert_node(left(h), x, inserted, t));
+		} else if (m_comp(key(h), x)) {
+			set_right(h, insert_node(right(h), x, inserted, t));
+		} else {
+			t.start(h);
+			return h;
+		}
+		t.push(h);
+		return fix_up(h, &t);
+	}
+
+	// links n unless its key is there already, t ends up as the path to that key
+	_Index link_node(_Index h, _Index n, bool& inserted, trail& t) {
+		if (h == nil) {
+			inserted = true;
+			t.start(n);
+			return n;
+		}
+		if (m_comp(key(n), key(h))) {
+			set_left(h, link_node(left(h), n, inserted, t));
+		} else if (m_comp(key(h), key(n))) {
+			set_right(h, link_node(right(h), n, inserted, t));
+		} else {
+			t.start(h);
+			return h;
+		}
+		t.push(h);
+		return fix_up(h, &t);
+	}
+
+	// unlinks the smallest node under h into min
+	_Index erase_min(_Index h, _Index& min) {
+		if (left(h) == nil) {
+			min = h;
+			return nil;
+		}
+		if (!is_red(left(h)) && !is_red(left(left(h))))
+			h = move_red_left(h);
+		set_left(h, erase_min(left(h), min));
+		return fix_up(h);
+	}
+
+	// x is in the subtree of h
+	_Index erase_node(_Index h, const_reference x) {
+		if (m_comp(x, key(h))) {
+			if (!is_red(left(h)) && !is_red(left(left(h))))
+				h = move_red_left(h);
+			set_left(h, erase_node(left(h), x));
+		} else {
+			if (is_red(left(h)))
+				h = rotate_right(h);
+			if (right(h) == nil && !m_comp(key(h), x)) {
+				free_node(h);
+				return nil;
+			}
+			if (!is_red(right(h)) && !is_red(left(right(h))))
+				h = move_red_right(h);
+			if (!m_comp(key(h), x)) {
+				// the successor node takes h's place, keys never move
+				_Index min;
+				_Index r = erase_min(right(h), min);
+				at(min).link[0] = at(h).link[0];
+				set_right(min, r);
+				free_node(h);
+				h = min;
+			} else {
+				set_right(h, erase_node(right(h), x));
+			}
+		}
+		return fix_up(h);
+	}
+
+	_Index allocate_node() {
+		if (free_list != nil) {
+			_Index n = free_list;
+			free_list = at(n).link[1];
+			return n;
+		}
+		if (fresh == red_bit)
+			throw std::length_error("compact_tree: out of node numbers");
+		if ((fresh >> chunk_shift) == chunks.size()) {
+			// the slot first, a chunk is not lost if push_back throws
+			chunks.push_back(NULL);
+			try {
+				chunks.back() = node_alloc.allocate(chunk_nodes);
+			} catch (...) {
+				chunks.pop_back();
+				throw;
+			}
+			if (fresh == 1)
+				at(nil).link[0] = at(nil).link[1] = nil; // left(nil) and right(nil) read it
+		}
+		return fresh++;
+	}
+
+	void deallocate_node(_Index n) {
+		at(n).link[1] = free_list;
+		free_list = n;
+	}
+
+	// a new red leaf holding a key constructed from args
+#if __cplusplus >= 201103L
+	template <typename... _Args>
+	_Index create_node(_Args&&... args) {
+		_Index n = allocate_node();
+		try {
+			::new (static_cast<void*>(&at(n).data)) _Key(std::forward<_Args>(args)...);
+		} catch (...) {
+			deallocate_node(n);
+			throw;
+		}
+		return init_node(n);
+	}
+#else
+	_Index create_node(const_reference x) {
+		_Index n = allocate_node();
+		try {
+			::new (static_cast<void*>(&at(n).data)) _Key(x);
+		} catch (...) {
+			deallocate_node(n);
+			throw;
+		}
+		return init_node(n);
+	}
+#endif
+
+	_Index init_node(_Index n) {
+		at(n).link[0] = red_bit;
+		at(n).link[1] = nil;
+		++m_size;
+		return n;
+	}
+
+	void free_node(_Index n) {
+		at(n).data.~_Key();
+		deallocate_node(n);
+		--m_size;
+	}
+
+	void destroy_keys(_Index n) {
+		while (n != nil) {
+			destroy_keys(left(n));
+			at(n).data.~_Key();
+			n = right(n);
+		}
+	}
+
+	// the first k keys in order, of a copy cut short
+	void destroy_keys(_Index n, size_type& k) {
+		while (n != nil && k > 0) {
+			destroy_keys(left(n), k);
+			if (k == 0)
+				return;
+			at(n).data.~_Key();
+			--k;
+			n = right(n);
+		}
+	}
+
+	void copy_keys(const compact_tree& other, _Index n) {
+		while (n != nil) {
+			copy_keys(other, other.left(n));
+			::new (static_cast<void*>(&at(n).data)) _Key(other.key(n));
+			++m_size;
+			n = other.right(n);
+		}
+	}
+
+	_Index lower_bound_node(const_reference x) const {
+		_Index ge = nil;
+		for (_Index n = m_root; n != nil; ) {
+			if (m_comp(key(n), x)) {
+				n = right(n);
+			} else {
+				ge = n;
+				n = left(n);
+			}
+		}
+		return ge;
+	}
+};
+
+template <typename _Key, typename _Compare, typename _Alloc, typename _Index>
+const _Index compact_tree<_Key, _Compare, _Alloc, _Index>::nil;
+
+template <typename _Key, typename _Compare, typename _Alloc, typename _Index>
+const _Index compact_tree<_Key, _Compare, _Alloc, _Index>::red_bit;
+
+template <typename _Key, typename _Compare, typename _Alloc, typename _Index>
+inline void swap(compact_tree<_Key, _Compare, _Alloc, _Index>& a, compact_tree<_Key, _Compare, _Alloc, _Index>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* COMPACT_TREE_H_ */
@@ -0,0 +1,399 @@
+/*
+ * concurrent_bst.h
+ *
+ *  Concurrent binary search tree (C++11), an ordered set with
+ *  - find / count / lower_bound / upper_bound that take no locks and write
+ *    no shared memory, readers scale with the cores
+ *  - insert / emplace / erase from any thread, a spin lock per node, only
+ *    the one or two nodes an update changes are locked
+ *  - no duplicates (acts like a set), same interface as skip_list
+ *  - weakly consistent forward iterators
+ *
+ *  Keys live in the leaves, internal nodes only route: a search goes left
+ *  for keys less than a node's key, right otherwise. An insert replaces a
+ *  leaf by a new internal node over the old and the new leaf, an erase
+ *  replaces the leaf's parent by the leaf's sibling. Either way one link
+ *  changes, so a find that reads links without locks sees the tree before
+ *  or after the update. Bounds are not that lucky: they take the left most
+ *  leaf of a subtree they passed, which an erase may have spliced out
+ *  meanwhile, and whose range then grew to take keys less than x. They
+ *  check what they found against x and search again from the root if it
+ *  is out of range. Writers descend without locks too, then lock the
+ *  parent (and grandparent for an erase) and check that the links they
+ *  came through are still there, else they start over. Nodes are locked
+ *  top down, which rules out deadlocks. Unlinked nodes go to the epoch
+ *  domain (see epoch.h) and are freed once no thread can still hold them.
+ *
+ *  There are 2n - 1 nodes, the internal ones hold a copy of a key. There is
+ *  no rebalancing: keys coming in random order keep it about 2 ln n deep,
+ *  sorted input degenerates to a list (the skip list does not care).
+ *
+ *  Iterators pin the epoch of their thread like skip_list's and have the
+ *  same guarantees. An increment is an upper_bound from the root, O(depth).
+ *
+ *  Destruction is not thread safe, clear() is.
+ */
+
+#ifndef CONCURRENT_BST_H_
+#define CONCURRENT_BST_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key> >
+class concurrent_bst {
+	struct node {
+		typename std::aligned_storage<sizeof(_Key), alignof(_Key)>::type storage; // unused by the root
+		std::atomic<node*> kid[2]; // 0 -> left, 1 -> right, both NULL for leaves
+		std::atomic<bool> locked;
+		bool leaf;
+		bool removed; // unlinked, guarded by the node's lock
+
+		_Key& data() { return *reinterpret_cast<_Key*>(&storage); }
+	};
+
+	static const _Key& key(node* n) { return n->data(); }
+
+public:
+	typedef _Key value_type;
+	typedef const _Key& reference;
+	typedef const _Key& const_reference;
+	typedef std::size_t size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	// a leaf, moves on to the leaf with the next key in the tree now
+	class iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : owner(NULL), pnode(NULL) { }
+		iterator(const iterator& other) : owner(other.owner), pnode(other.pnode) { }
+		iterator& operator=(const iterator& other) {
+			owner = other.owner;
+			pnode = other.pnode;
+			return *this;
+		}
+		bool operator==(const iterator& other) const { return pnode == other.pnode; }
+		bool operator!=(const iterator& other) const { return pnode != other.pnode; }
+		iterator& operator++() {
+			pnode = owner->upper_bound_node(key(pnode));
+			return *this;
+		}
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		reference operator*() const { return key(pnode); }
+		pointer operator->() const { return &key(pnode); }
+	private:
+		friend class concurrent_bst;
+		iterator(const concurrent_bst* _owner, node* n) : owner(_owner), pnode(n) { }
+		epoch_guard guard; // pnode stays allocated while we live
+		const concurrent_bst* owner;
+		node* pnode;
+	};
+
+	typedef iterator const_iterator;
+
+	// the root routes every key to its left, as if its key was infinite
+	explicit concurrent_bst(const _Compare& comp = _Compare())
+		: root(alloc_node(false)), m_size(0), m_comp(comp) { }
+
+	~concurrent_bst() {
+		std::vector<node*> stack;
+		if (node* n = root->kid[0].load())
+			stack.push_back(n);
+		while (!stack.empty()) {
+			node* n = stack.back();
+			stack.pop_back();
+			if (!n->leaf) {
+				stack.push_back(n->kid[0].load());
+				stack.push_back(n->kid[1].load());
+			}
+			free_node(n);
+		}
+		delete root;
+	}
+
+	// exact when no update is running
+	size_type size() const { return m_size.load(std::memory_order_relaxed); }
+	bool empty() const { return root->kid[0].load(std::memory_order_acquire) == NULL; }
+	key_compare key_comp() const { return m_comp; }
+
+	// erases one key after the other, other threads may keep inserting
+	void clear() {
+		epoch_guard guard;
+		for (node* n = first(); n; n = first())
+			erase(key(n));
+	}
+
+	std::pair<iterator, bool> insert(const _Key& x) { return insert_leaf(create_leaf(x)); }
+	std::pair<iterator, bool> insert(_Key&& x) { return insert_leaf(create_leaf(std::move(x))); }
+
+	template <typename... _Args>
+	std::pair<iterator, bool> emplace(_Args&&... args) {
+		return insert_leaf(create_leaf(std::forward<_Args>(args)...));
+	}
+
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_type erase(const _Key& x) {
+		epoch_guard guard;
+		for (;;) {
+			position pos;
+			search(x, pos);
+			if (!pos.l || !equal(key(pos.l), x))
+				return 0;
+			if (pos.p == root) {
+				// the only key, the tree becomes empty
+				lock(root);
+				bool valid = root->kid[0].load(std::memory_order_relaxed) == pos.l;
+				if (valid)
+					root->kid[0].store(NULL, std::memory_order_release);
+				unlock(root);
+				if (!valid)
+					continue;
+			} else {
+				lock(pos.gp);
+				lock(pos.p);
+				bool valid = !pos.gp->removed && pos.gp->kid[pos.pdir].load(std::memory_order_relaxed) == pos.p
+					&& !pos.p->removed && pos.p->kid[pos.ldir].load(std::memory_order_relaxed) == pos.l;
+				if (valid) {
+					node* sibling = pos.p->kid[1 - pos.ldir].load(std::memory_order_relaxed);
+					pos.p->removed = true;
+					pos.gp->kid[pos.pdir].store(sibling, std::memory_order_release);
+				}
+				unlock(pos.p);
+				unlock(pos.gp);
+				if (!valid)
+					continue;
+				// the parent keeps its links, searches in it still end up in the tree
+				epoch_domain::instance().retire(pos.p, free_node);
+			}
+			epoch_domain::instance().retire(pos.l, free_node);
+			--m_size;
+			return 1;
+		}
+	}
+
+	size_type count(const _Key& x) const {
+		epoch_guard guard;
+		node* next;
+		node* l = find_leaf(x, next);
+		return l && equal(key(l), x);
+	}
+
+	iterator find(const _Key& x) const {
+		epoch_guard guard;
+		node* next;
+		node* l = find_leaf(x, next);
+		return iterator(this, l && equal(key(l), x) ? l : NULL);
+	}
+
+	// first key not less than x
+	iterator lower_bound(const _Key& x) const {
+		epoch_guard guard;
+		return iterator(this, lower_bound_node(x));
+	}
+
+	// first key greater than x
+	iterator upper_bound(const _Key& x) const {
+		epoch_guard guard;
+		return iterator(this, upper_bound_node(x));
+	}
+
+	iterator begin() const {
+		epoch_guard guard;
+		return iterator(this, first());
+	}
+
+	iterator end() const { return iterator(); }
+
+private:
+	node* root;
+	std::atomic<size_type> m_size;
+	_Compare m_comp;
+
+	concurrent_bst(const concurrent_bst&);
+	concurrent_bst& operator=(const concurrent_bst&);
+
+	// where a key is or would be: its leaf l (NULL if the tree is empty) at p->kid[ldir]
+	struct position {
+		node* gp;
+		node* p;
+		node* l;
+		int pdir; // p is gp->kid[pdir]
+		int ldir;
+	};
+
+	bool equal(const _Key& a, const _Key& b) const { return !m_comp(a, b) && !m_comp(b, a); }
+
+	static void lock(node* n) {
+		while (n->locked.exchange(true, std::memory_order_acquire)) {
+			while (n->locked.load(std::memory_order_relaxed))
+				std::this_thread::yield();
+		}
+	}
+
+	static void unlock(node* n) { n->locked.store(false, std::memory_order_release); }
+
+	static node* alloc_node(bool leaf) {
+		node* n = new node;
+		n->kid[0].store(NULL, std::memory_order_relaxed);
+		n->kid[1].store(NULL, std::memory_order_relaxed);
+		n->locked.store(false, std::memory_order_relaxed);
+		n->leaf = leaf;
+		n->removed = false;
+		return n;
+	}
+
+	template <typename... _Args>
+	static node* create_leaf(_Args&&... args) {
+		node* n = alloc_node(true);
+		try {
+			new (&n->storage) _Key(std::forward<_Args>(args)...);
+		} catch (...) {
+			delete n;
+			throw;
+		}
+		return n;
+	}
+
+	// an internal node over two leaves, routing by the greater key
+	static node* create_internal(node* less, node* greater) {
+		node* n = alloc_node(false);
+		try {
+			new (&n->storage) _Key(key(greater));
+		} catch (...) {
+			delete n;
+			throw;
+		}
+		n->kid[0].store(less, std::memory_order_relaxed);
+		n->kid[1].store(greater, std::memory_order_relaxed);
+		return n;
+	}
+
+	// the epoch domain deleter, every node but the root has a key
+	static void free_node(void* p) {
+		node* n = static_cast<node*>(p);
+		n->data().~_Key();
+		delete n;
+	}
+
+	// no locks, the links may change meanwhile
+	void search(const _Key& x, position& pos) const {
+		pos.gp = NULL;
+		pos.p = root;
+		pos.pdir = pos.ldir = 0;
+		pos.l = root->kid[0].load(std::memory_order_acquire);
+		while (pos.l && !pos.l->leaf) {
+			pos.gp = pos.p;
+			pos.pdir = pos.ldir;
+			pos.p = pos.l;
+			pos.ldir = !m_comp(x, key(pos.l));
+			pos.l = pos.l->kid[pos.ldir].load(std::memory_order_acquire);
+		}
+	}
+
+	std::pair<iterator, bool> insert_leaf(node* n) {
+		epoch_guard guard;
+		for (;;) {
+			position pos;
+			search(key(n), pos);
+			if (pos.l && equal(key(pos.l), key(n))) {
+				free_node(n); // never published
+				return std::make_pair(iterator(this, pos.l), false);
+			}
+			node* in = NULL;
+			if (pos.l) {
+				try {
+					in = m_comp(key(n), key(pos.l)) ? create_internal(n, pos.l) : create_internal(pos.l, n);
+				} catch (...) {
+					free_node(n);
+					throw;
+				}
+			}
+			lock(pos.p);
+			bool valid = !pos.p->removed && pos.p->kid[pos.ldir].load(std::memory_order_relaxed) == pos.l;
+			if (valid)
+				pos.p->kid[pos.ldir].store(in ? in : n, std::memory_order_release);
+			unlock(pos.p);
+			if (valid)
+				break;
+			if (in)
+				free_node(in);
+		}
+		++m_size;
+		return std::make_pair(iterator(this, n), true);
+	}
+
+	static node* left_most(node* n) {
+		while (n && !n->leaf)
+			n = n->kid[0].load(std::memory_order_acquire);
+		return n;
+	}
+
+	node* first() const { return left_most(root->kid[0].load(std::memory_order_acquire)); }
+
+	/* the leaf a search for x ends in, next is the right kid of the last
+	 node it went left from: its left most leaf follows every key down there */
+	node* find_leaf(const _Key& x, node*& next) const {
+		next = NULL;
+		node* n = root->kid[0].load(std::memory_order_acquire);
+		while (n && !n->leaf) {
+			if (m_comp(x, key(n))) {
+				next = n->kid[1].load(std::memory_order_acquire);
+				n = n->kid[0].load(std::memory_order_acquire);
+			} else {
+				n = n->kid[1].load(std::memory_order_acquire);
+			}
+		}
+		return n;
+	}
+
+	// next may have been unlinked under us, leaves of it less than x go round again
+	node* lower_bound_node(const _Key& x) const {
+		for (;;) {
+			node* next;
+			node* l = find_leaf(x, next);
+			if (l && !m_comp(key(l), x))
+				return l;
+			node* n = left_most(next);
+			if (!n || !m_comp(key(n), x))
+				return n;
+		}
+	}
+
+	node* upper_bound_node(const _Key& x) const {
+		for (;;) {
+			node* next;
+			node* l = find_leaf(x, next);
+			if (l && m_comp(x, key(l)))
+				return l;
+			node* n = left_most(next);
+			if (!n || m_comp(x, key(n)))
+				return n;
+		}
+	}
+};
+
+}; // namespace
+
+#endif /* CONCURRENT_BST_H_ */
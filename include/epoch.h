@@ -0,0 +1,204 @@
+/*
+ * epoch.h
+ *
+ *  Epoch based memory reclamation for the lock-free containers (C++11)
+ *
+ *  Readers pin the current epoch with an epoch_guard while they touch
+ *  shared nodes. A writer that unlinked a node retires it, the node is
+ *  freed once the global epoch moved on twice: by then every thread that
+ *  could have seen it has left its guard.
+ *
+ *  - epoch_guard pins the calling thread, guards nest and are cheap
+ *  - epoch_domain::retire(p, deleter) frees p later with deleter(p)
+ *  - one global domain, every thread gets a record on first use and gives
+ *    it back (with whatever it still has to free) when it exits
+ *
+ *  A thread that stays pinned forever stops all reclamation, so keep
+ *  guards (and iterators, which hold one) short lived.
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#if __cplusplus < 201103L
+#error "epoch.h needs C++11 atomics"
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace yadslib {
+
+class epoch_domain {
+public:
+	typedef void (*deleter_type)(void*);
+
+	static epoch_domain& instance() {
+		static epoch_domain domain;
+		return domain;
+	}
+
+	// free p with deleter(p) once no guard can still see it
+	void retire(void* p, deleter_type deleter) {
+		record* rec = local_record();
+		rec->limbo.push_back(retired(p, deleter, global_epoch.load()));
+		if (++rec->retire_count % collect_interval == 0)
+			collect(rec);
+	}
+
+	// try to advance the epoch and free what is safe, also run by retire()
+	void collect() { collect(local_record()); }
+
+	~epoch_domain() {
+		// threads are gone by now, nothing can be pinned
+		record* rec = records.load();
+		while (rec) {
+			record* next = rec->next;
+			free_all(rec->limbo);
+			delete rec;
+			rec = next;
+		}
+		free_all(orphans);
+	}
+
+private:
+	friend class epoch_guard;
+
+	enum { collect_interval = 64 };
+
+	struct retired {
+		void* p;
+		deleter_type deleter;
+		std::uint64_t epoch;
+		retired(void* _p, deleter_type _deleter, std::uint64_t _epoch) : p(_p), deleter(_deleter), epoch(_epoch) { }
+	};
+
+	// one per thread, never freed before the domain, reused after a thread exits
+	struct record {
+		std::atomic<std::uint64_t> local; // epoch << 1 | pinned
+		std::atomic<bool> in_use;
+		record* next;
+		unsigned nesting;
+		unsigned retire_count;
+		std::vector<retired> limbo;
+		record() : local(0), in_use(true), next(NULL), nesting(0), retire_count(0) { }
+	};
+
+	// gives the record back when its thread exits
+	struct thread_handle {
+		record* rec;
+		thread_handle() : rec(NULL) { }
+		~thread_handle() {
+			if (rec)
+				instance().release(rec);
+		}
+	};
+
+	std::atomic<std::uint64_t> global_epoch;
+	std::atomic<record*> records;
+	std::mutex orphans_lock;
+	std::vector<retired> orphans; // left behind by threads that exited
+
+	epoch_domain() : global_epoch(2), records(NULL) { }
+	epoch_domain(const epoch_domain&);
+	epoch_domain& operator=(const epoch_domain&);
+
+	record* local_record() {
+		static thread_local thread_handle handle;
+		if (handle.rec == NULL)
+			handle.rec = acquire();
+		return handle.rec;
+	}
+
+	record* acquire() {
+		for (record* rec = records.load(); rec; rec = rec->next) {
+			bool expected = false;
+			if (!rec->in_use.load() && rec->in_use.compare_exchange_strong(expected, true))
+				return rec;
+		}
+		record* rec = new record();
+		record* head = records.load();
+		do {
+			rec->next = head;
+		} while (!records.compare_exchange_weak(head, rec));
+		return rec;
+	}
+
+	void release(record* rec) {
+		collect(rec);
+		if (!rec->limbo.empty()) {
+			std::lock_guard<std::mutex> lock(orphans_lock);
+			orphans.insert(orphans.end(), rec->limbo.begin(), rec->limbo.end());
+			rec->limbo.clear();
+		}
+		rec->in_use.store(false);
+	}
+
+	void pin(record* rec) {
+		if (rec->nesting++ == 0) {
+			// seq_cst store, the advancing thread must see us before we read anything
+			rec->local.store(global_epoch.load() << 1 | 1);
+		}
+	}
+
+	void unpin(record* rec) {
+		if (--rec->nesting == 0)
+			rec->local.store(0, std::memory_order_release);
+	}
+
+	// the epoch moves on only when every pinned thread has seen the current one
+	void try_advance() {
+		std::uint64_t epoch = global_epoch.load();
+		for (record* rec = records.load(); rec; rec = rec->next) {
+			std::uint64_t local = rec->local.load();
+			if ((local & 1) && (local >> 1) != epoch)
+				return;
+		}
+		global_epoch.compare_exchange_strong(epoch, epoch + 1);
+	}
+
+	// free everything retired at least two epochs ago
+	static void free_old(std::vector<retired>& limbo, std::uint64_t epoch) {
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < limbo.size(); ++i) {
+			if (limbo[i].epoch + 2 <= epoch)
+				limbo[i].deleter(limbo[i].p);
+			else
+				limbo[kept++] = limbo[i];
+		}
+		limbo.erase(limbo.begin() + kept, limbo.end());
+	}
+
+	static void free_all(std::vector<retired>& limbo) {
+		for (std::size_t i = 0; i < limbo.size(); ++i)
+			limbo[i].deleter(limbo[i].p);
+		limbo.clear();
+	}
+
+	void collect(record* rec) {
+		try_advance();
+		std::uint64_t epoch = global_epoch.load();
+		free_old(rec->limbo, epoch);
+		std::unique_lock<std::mutex> lock(orphans_lock, std::try_to_lock);
+		if (lock.owns_lock())
+			free_old(orphans, epoch);
+	}
+};
+
+// pins the calling thread to the current epoch for its lifetime
+class epoch_guard {
+public:
+	epoch_guard() : rec(epoch_domain::instance().local_record()) { epoch_domain::instance().pin(rec); }
+	epoch_guard(const epoch_guard&) : rec(epoch_domain::instance().local_record()) { epoch_domain::instance().pin(rec); }
+	~epoch_guard() { epoch_domain::instance().unpin(rec); }
+private:
+	epoch_domain::record* rec;
+	epoch_guard& operator=(const epoch_guard&);
+};
+
+}; // namespace
+
+#endif /* EPOCH_H_ */
@@ -0,0 +1,280 @@
+/*
+ * flat_set.h
+ *
+ *  Ordered set in one sorted array, for small and medium sets where a
+ *  pointer tree loses to plain contiguous memory, with
+ *  - iterators that are plain pointers, iteration is a linear scan
+ *  - branch free lower_bound: halving steps without branches down to one
+ *    cache line of keys, which integer keys compare at once with SIMD
+ *    (see block_search.h)
+ *  - buffered inserts: new keys go to a short unsorted tail behind the
+ *    sorted keys, a full tail is sorted and merged in one go, O(n / t)
+ *    moves per insert for a tail of t keys instead of O(n)
+ *  - no duplicates (acts like a set), the interface of binary_search_tree
+ *
+ *  insert() returns whether the key is new instead of an iterator, the key
+ *  may still be in the tail. count() and erase() look at the tail as well,
+ *  everything that deals in positions (find, bounds, begin / end, min / max)
+ *  merges the tail first. That modifies a const set: share it between
+ *  threads only after a flush(). Inserts and erases invalidate iterators.
+ */
+
+#ifndef FLAT_SET_H_
+#define FLAT_SET_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "block_search.h"
+#include "traits.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key>,
+	typename _Alloc = std::allocator<_Key> >
+class flat_set {
+public:
+	typedef _Alloc allocator_type;
+	typedef typename _Alloc::value_type value_type;
+	typedef typename _Alloc::reference reference;
+	typedef typename _Alloc::const_reference const_reference;
+	typedef typename _Alloc::pointer pointer;
+	typedef typename _Alloc::const_pointer const_pointer;
+	typedef typename _Alloc::size_type size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	typedef const _Key* iterator;
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	// keys compared at once at the end of a lookup, a cache line
+	static const size_t block_keys = sizeof(_Key) >= 64 ? 1 : 64 / sizeof(_Key);
+
+	// unsorted keys kept back before a merge
+	static const size_t tail_capacity = 32;
+
+	explicit flat_set(const _Compare& comp = _Compare()) : sorted(0), m_comp(comp) { }
+
+	// from a sorted range without duplicates, no sorting
+	template <typename _InputIterator>
+	flat_set(sorted_unique_t, _InputIterator first, _InputIterator last, const _Compare& comp = _Compare())
+		: keys(first, last), sorted(keys.size()), m_comp(comp) { }
+
+	template <typename _InputIterator>
+	flat_set(_InputIterator first, _InputIterator last, const _Compare& comp = _Compare())
+		: sorted(0), m_comp(comp) {
+		insert(first, last);
+	}
+
+	void swap(flat_set& other) {
+		using std::swap;
+		keys.swap(other.keys);
+		swap(sorted, other.sorted);
+		swap(m_comp, other.m_comp);
+	}
+
+	size_t size() const { return keys.size(); }
+
+	bool empty() const { return keys.empty(); }
+
+	key_compare key_comp() const { return m_comp; }
+
+	void clear() {
+		keys.clear();
+		sorted = 0;
+	}
+
+	void reserve(size_t n) { keys.reserve(n); }
+
+	size_t capacity() const { return keys.capacity(); }
+
+	// false if x was there already
+	bool insert(const_reference x) {
+		if (count(x))
+			return false;
+		keys.push_back(x);
+		if (keys.size() - sorted >= tail_capacity)
+			merge_tail();
+		return true;
+	}
+
+#if __cplusplus >= 201103L
+	bool insert(value_type&& x) {
+		if (count(x))
+			return false;
+		keys.push_back(std::move(x));
+		if (keys.size() - sorted >= tail_capacity)
+			merge_tail();
+		return true;
+	}
+#endif
+
+	/* the whole range goes to the tail and is merged once, O(n + m log m)
+	 for m keys. Keys already there and repeats in the range are dropped */
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		keys.insert(keys.end(), first, last);
+		typename std::vector<_Key, _Alloc>::iterator mid = keys.begin() + sorted;
+		std::sort(mid, keys.end(), m_comp);
+		keys.erase(std::unique(mid, keys.end(), equivalent(m_comp)), keys.end());
+		std::inplace_merge(keys.begin(), mid, keys.end(), m_comp);
+		keys.erase(std::unique(keys.begin(), keys.end(), equivalent(m_comp)), keys.end());
+		sorted = keys.size();
+	}
+
+	// the tail is only swept, erasing a sorted key moves the keys after it
+	size_t erase(const_reference x) {
+		size_t i = tail_position(x);
+		if (i < keys.size()) {
+			keys[i] = keys.back();
+			keys.pop_back();
+			return 1;
+		}
+		size_t pos = lower_bound_pos(x);
+		if (pos == sorted || m_comp(x, keys[pos]))
+			return 0;
+		keys.erase(keys.begin() + pos);
+		--sorted;
+		return 1;
+	}
+
+	template <typename _InputIterator>
+	void erase(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			erase(*first);
+	}
+
+	// the only lookup that leaves the tail alone
+	size_t count(const_reference x) const {
+		size_t pos = lower_bound_pos(x);
+		if (pos < sorted && !m_comp(x, keys[pos]))
+			return 1;
+		return tail_position(x) < keys.size() ? 1 : 0;
+	}
+
+	iterator find(const_reference x) const {
+		flush();
+		size_t pos = lower_bound_pos(x);
+		return (pos < sorted && !m_comp(x, keys[pos])) ? at(pos) : end();
+	}
+
+	// first key not less than x
+	iterator lower_bound(const_reference x) const {
+		flush();
+		return at(lower_bound_pos(x));
+	}
+
+	// first key greater than x
+	iterator upper_bound(const_reference x) const {
+		flush();
+		return at(upper_bound_pos(x));
+	}
+
+	std::pair<iterator, iterator> equal_range(const_reference x) const {
+		return std::make_pair(lower_bound(x), upper_bound(x));
+	}
+
+	// merge the tail now, say before handing the set to other threads
+	void flush() const {
+		if (sorted < keys.size())
+			merge_tail();
+	}
+
+	iterator begin() const {
+		flush();
+		return at(0);
+	}
+
+	iterator end() const {
+		flush();
+		return at(sorted);
+	}
+
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return *begin(); }
+	const_reference max() const { return *(end() - 1); }
+
+private:
+	// sorted keys, then the tail. Mutable so const lookups can merge it
+	mutable std::vector<_Key, _Alloc> keys;
+	mutable size_t sorted;
+	_Compare m_comp;
+
+	struct equivalent {
+		_Compare comp;
+		explicit equivalent(const _Compare& _comp) : comp(_comp) { }
+		bool operator()(const _Key& a, const _Key& b) const { return !comp(a, b) && !comp(b, a); }
+	};
+
+	iterator at(size_t pos) const { return keys.empty() ? NULL : &keys[0] + pos; }
+
+	// tail keys are unique and none is in the sorted part
+	void merge_tail() const {
+		typename std::vector<_Key, _Alloc>::iterator mid = keys.begin() + sorted;
+		std::sort(mid, keys.end(), m_comp);
+		std::inplace_merge(keys.begin(), mid, keys.end(), m_comp);
+		sorted = keys.size();
+	}
+
+	// where x is in the tail, size() if not, every tail key is compared
+	size_t tail_position(const_reference x) const {
+		size_t found = keys.size();
+		for (size_t i = sorted; i < keys.size(); ++i) {
+			if (!m_comp(keys[i], x) && !m_comp(x, keys[i]))
+				found = i;
+		}
+		return found;
+	}
+
+	/* the answer stays within [base, base + n], each step drops the half
+	 that cannot hold it without a branch. Once a block is left it is
+	 ranked in one go, moved back to lie within the keys if need be: the
+	 keys it gains in front are all less than x and are counted too */
+	size_t lower_bound_pos(const_reference x) const {
+		if (sorted < block_keys)
+			return detail::block_rank<_Key, _Compare>::count_less(at(0), sorted, x, m_comp);
+		const _Key* first = &keys[0];
+		const _Key* base = first;
+		size_t n = sorted;
+		while (n > block_keys) {
+			size_t half = n / 2;
+			base = m_comp(base[half - 1], x) ? base + half : base;
+			n -= half;
+		}
+		base = std::min(base, first + sorted - block_keys);
+		return base - first + detail::count_less(base, block_keys, x, m_comp);
+	}
+
+	size_t upper_bound_pos(const_reference x) const {
+		if (sorted < block_keys)
+			return detail::block_rank<_Key, _Compare>::count_not_greater(at(0), sorted, x, m_comp);
+		const _Key* first = &keys[0];
+		const _Key* base = first;
+		size_t n = sorted;
+		while (n > block_keys) {
+			size_t half = n / 2;
+			base = m_comp(x, base[half - 1]) ? base : base + half;
+			n -= half;
+		}
+		base = std::min(base, first + sorted - block_keys);
+		return base - first + detail::count_not_greater(base, block_keys, x, m_comp);
+	}
+};
+
+template <typename _Key, typename _Compare, typename _Alloc>
+inline void swap(flat_set<_Key, _Compare, _Alloc>& a, flat_set<_Key, _Compare, _Alloc>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* FLAT_SET_H_ */
@@ -0,0 +1,473 @@
+/*
+ * frozen_set.h
+ *
+ *  Read only ordered set, built once from a sorted range and then only
+ *  queried, with
+ *  - keys in one sorted array, iterators are plain pointers
+ *  - an implicit search tree on top (no pointers): cache line sized nodes
+ *    of separator keys, children found by index arithmetic, the bottom
+ *    level points straight into the sorted array
+ *  - branch free lookups, one cache line per level, integer keys compare
+ *    a whole line at once with SIMD (see block_search.h)
+ *  - the same bytes in memory and on disk: write() streams a sorted range
+ *    to a file in one pass, open() maps it read only, nothing is allocated
+ *    or copied, startup costs page faults only
+ *  - find / count / lower_bound / upper_bound like binary_search_tree, and
+ *    batched find / count that overlap the cache misses of many lookups
+ *
+ *  To freeze a binary_search_tree t:
+ *  	frozen_set<int> f(sorted_unique, t.begin(), t.end());
+ *
+ *  Keys are stored as raw bytes and must be trivially copyable (no
+ *  pointers either, if the file is to be opened by another process). A file
+ *  only opens with the same key size, block size and byte order.
+ *
+ *  File layout (all offsets from the start of the file):
+ *  - frozen_header, padded to a cache line
+ *  - count keys in ascending order, padded to a whole block with copies of
+ *    the last key
+ *  - the index nodes, block_keys separators each, root layer first. Node j
+ *    of a layer has children j * fanout .. j * fanout + block_keys in the
+ *    layer below (or leaf blocks of the key array), separator i is the
+ *    smallest key under child i + 1
+ */
+
+#ifndef FROZEN_SET_H_
+#define FROZEN_SET_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FROZEN_SET_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "block_search.h"
+#include "traits.h"
+
+namespace yadslib {
+
+struct frozen_header {
+	char magic[8]; // "yadsfrz"
+	uint32_t version;
+	uint32_t byte_order; // 0x01020304 as written
+	uint32_t key_size;
+	uint32_t block_keys;
+	uint64_t count;
+	uint64_t keys_offset;
+	uint64_t index_offset;
+	uint64_t index_keys;
+};
+
+template <typename _Key, typename _Compare = std::less<_Key> >
+class frozen_set {
+public:
+	static const std::size_t cache_line_size = 64;
+
+	// keys per node and leaf block, one cache line full
+	enum {
+		block_keys = sizeof(_Key) >= cache_line_size ? 1 : cache_line_size / sizeof(_Key),
+		fanout = block_keys + 1
+	};
+
+	typedef _Key value_type;
+	typedef const _Key& reference;
+	typedef const _Key& const_reference;
+	typedef const _Key* pointer;
+	typedef const _Key* const_pointer;
+	typedef std::size_t size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	typedef const _Key* iterator;
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	explicit frozen_set(const _Compare& comp = _Compare()) : m_comp(comp) { reset(); }
+
+	// lays the range out in memory, exactly as write() would on disk
+	template <typename _InputIterator>
+	frozen_set(sorted_unique_t, _InputIterator first, _InputIterator last,
+			const _Compare& comp = _Compare()) : m_comp(comp) {
+		reset();
+		memory_sink sink(owned);
+		write_image(sink, first, last);
+		attach(&owned[0], owned.size());
+	}
+
+	~frozen_set() { close(); }
+
+	/* writes a sorted range without duplicates to path in one sequential
+	 pass. Throws std::runtime_error if the file cannot be written */
+	template <typename _InputIterator>
+	static void write(const char* path, _InputIterator first, _InputIterator last) {
+		std::FILE* f = std::fopen(path, "wb");
+		if (!f)
+			throw std::runtime_error("frozen_set: cannot create file");
+		file_sink sink(f);
+		try {
+			write_image(sink, first, last);
+		} catch (...) {
+			std::fclose(f);
+			throw;
+		}
+		if (std::fclose(f) != 0)
+			throw std::runtime_error("frozen_set: cannot write file");
+	}
+
+	/* maps a file made by write(), read only. Throws std::runtime_error if
+	 it cannot be read or was written for another key type */
+	void open(const char* path) {
+		close();
+#ifdef FROZEN_SET_MMAP
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("frozen_set: cannot open file");
+		struct stat st;
+		void* p = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			throw std::runtime_error("frozen_set: cannot map file");
+		mapping = p;
+		mapping_len = st.st_size;
+		try {
+			attach(static_cast<const char*>(p), mapping_len);
+		} catch (...) {
+			close();
+			throw;
+		}
+#else
+		// no mmap, read it all
+		std::FILE* f = std::fopen(path, "rb");
+		if (!f)
+			throw std::runtime_error("frozen_set: cannot open file");
+		char buf[4096];
+		std::size_t got;
+		while ((got = std::fread(buf, 1, sizeof(buf), f)) > 0)
+			owned.insert(owned.end(), buf, buf + got);
+		std::fclose(f);
+		try {
+			attach(owned.empty() ? NULL : &owned[0], owned.size());
+		} catch (...) {
+			close();
+			throw;
+		}
+#endif
+	}
+
+	// unmaps or frees the keys, the set is empty afterwards
+	void close() {
+#ifdef FROZEN_SET_MMAP
+		if (mapping)
+			munmap(mapping, mapping_len);
+#endif
+		std::vector<char>().swap(owned);
+		reset();
+	}
+
+	void swap(frozen_set& other) {
+		std::swap(keys, other.keys);
+		std::swap(n, other.n);
+		std::swap(layers, other.layers);
+		for (std::size_t h = 0; h <= max_layers; ++h) {
+			std::swap(layer_nodes[h], other.layer_nodes[h]);
+			std::swap(layer_keys[h], other.layer_keys[h]);
+		}
+		owned.swap(other.owned); // the buffers stay where they are
+		std::swap(mapping, other.mapping);
+		std::swap(mapping_len, other.mapping_len);
+		std::swap(m_comp, other.m_comp);
+	}
+
+	size_type size() const { return n; }
+	bool empty() const { return n == 0; }
+	key_compare key_comp() const { return m_comp; }
+
+	iterator begin() const { return keys; }
+	iterator end() const { return keys + n; }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return keys[0]; }
+	const_reference max() const { return keys[n - 1]; }
+
+	// i-th smallest key
+	const_reference operator[](size_type i) const { return keys[i]; }
+
+	size_type count(const _Key& x) const { return find(x) != end(); }
+
+	iterator find(const _Key& x) const {
+		iterator it = lower_bound(x);
+		return (it != end() && !m_comp(x, *it)) ? it : end();
+	}
+
+	// first key not less than x
+	iterator lower_bound(const _Key& x) const { return keys + search<false>(x); }
+
+	// first key greater than x
+	iterator upper_bound(const _Key& x) const { return keys + search<true>(x); }
+
+	std::pair<iterator, iterator> equal_range(const _Key& x) const {
+		return std::make_pair(lower_bound(x), upper_bound(x));
+	}
+
+	// lookups advancing together in find_batch / count_batch
+	static const size_type batch_width = 16;
+
+	/* find() for every key of [first, last), results in order to out. Every
+	 layer is ranked for up to batch_width keys before the next one, and
+	 the child nodes are prefetched while the other keys are ranked */
+	template <typename _ForwardIterator, typename _OutputIterator>
+	_OutputIterator find_batch(_ForwardIterator first, _ForwardIterator last, _OutputIterator out) const {
+		size_type found[batch_width];
+		while (first != last) {
+			_ForwardIterator batch = first;
+			size_type k = search_batch(first, last, found);
+			for (size_type i = 0; i < k; ++i, ++batch)
+				*out++ = (found[i] < n && !m_comp(*batch, keys[found[i]])) ? keys + found[i] : end();
+		}
+		return out;
+	}
+
+	// count() for every key of [first, last), like find_batch
+	template <typename _ForwardIterator, typename _OutputIterator>
+	_OutputIterator count_batch(_ForwardIterator first, _ForwardIterator last, _OutputIterator out) const {
+		size_type found[batch_width];
+		while (first != last) {
+			_ForwardIterator batch = first;
+			size_type k = search_batch(first, last, found);
+			for (size_type i = 0; i < k; ++i, ++batch)
+				*out++ = (found[i] < n && !m_comp(*batch, keys[found[i]])) ? size_type(1) : size_type(0);
+		}
+		return out;
+	}
+
+private:
+	enum { max_layers = 64, version = 1, byte_order = 0x01020304 };
+
+	const _Key* keys;
+	size_type n;
+	size_type layers; // index layers above the leaf blocks
+	size_type layer_nodes[max_layers + 1]; // layer_nodes[0] leaf blocks
+	const _Key* layer_keys[max_layers + 1]; // layer_keys[0] the sorted keys
+	std::vector<char> owned; // the image when it is not mapped
+	void* mapping;
+	size_type mapping_len;
+	_Compare m_comp;
+
+	frozen_set(const frozen_set&);
+	frozen_set& operator=(const frozen_set&);
+
+	void reset() {
+		keys = NULL;
+		n = 0;
+		layers = 0;
+		layer_nodes[0] = 0;
+		layer_keys[0] = NULL;
+		mapping = NULL;
+		mapping_len = 0;
+	}
+
+	static size_type round_up(size_type x, size_type to) { return (x + to - 1) / to * to; }
+
+	/* node counts for every layer, the root layer has a single node.
+	 Returns the number of index keys */
+	static size_type geometry(size_type count, size_type* nodes, size_type& height) {
+		nodes[0] = (count + block_keys - 1) / block_keys;
+		height = 0;
+		size_type total = 0;
+		while (nodes[height] > 1) {
+			nodes[height + 1] = (nodes[height] + fanout - 1) / fanout;
+			total += nodes[++height] * block_keys;
+		}
+		return total;
+	}
+
+	// keys before x in the block, or before and equal to x for _Upper
+	template <bool _Upper>
+	size_type rank_in_block(const _Key* p, size_type count, const _Key& x) const {
+		return _Upper ? detail::count_not_greater(p, count, x, m_comp) : detail::count_less(p, count, x, m_comp);
+	}
+
+	/* number of keys before x (or not after it). Every layer costs one
+	 cache line and one branch free block rank, the child index only
+	 depends on how many separators came before x */
+	template <bool _Upper>
+	size_type search(const _Key& x) const {
+		if (n == 0)
+			return 0;
+		size_type c = 0;
+		for (size_type h = layers; h > 0; --h) {
+			size_type seps = std::min<size_type>(fanout, layer_nodes[h - 1] - c * fanout) - 1;
+			c = c * fanout + rank_in_block<_Upper>(layer_keys[h] + c * block_keys, seps, x);
+		}
+		size_type first = c * block_keys;
+		return first + rank_in_block<_Upper>(keys + first, std::min<size_type>(block_keys, n - first), x);
+	}
+
+	// search<false> for the next batch_width keys at most, first moves past them
+	template <typename _ForwardIterator>
+	size_type search_batch(_ForwardIterator& first, _ForwardIterator last, size_type* found) const {
+		_ForwardIterator batch[batch_width];
+		size_type k = 0;
+		for (; k < batch_width && first != last; ++k, ++first) {
+			batch[k] = first;
+			found[k] = 0; // node index in the current layer
+		}
+		if (n == 0)
+			return k;
+		// every descent has the same length, the layers go in lock step
+		for (size_type h = layers; h > 0; --h) {
+			for (size_type i = 0; i < k; ++i) {
+				size_type c = found[i];
+				size_type seps = std::min<size_type>(fanout, layer_nodes[h - 1] - c * fanout) - 1;
+				c = c * fanout + rank_in_block<false>(layer_keys[h] + c * block_keys, seps, *batch[i]);
+				detail::prefetch(layer_keys[h - 1] + c * block_keys);
+				found[i] = c;
+			}
+		}
+		for (size_type i = 0; i < k; ++i) {
+			size_type first_key = found[i] * block_keys;
+			found[i] = first_key + rank_in_block<false>(keys + first_key,
+				std::min<size_type>(block_keys, n - first_key), *batch[i]);
+		}
+		return k;
+	}
+
+	// checks an image made by write_image and points into it
+	void attach(const char* base, size_type len) {
+		frozen_header hdr;
+		if (len < sizeof(hdr))
+			throw std::runtime_error("frozen_set: file too short");
+		std::memcpy(&hdr, base, sizeof(hdr));
+		if (std::memcmp(hdr.magic, "yadsfrz", 8) != 0 || hdr.version != version)
+			throw std::runtime_error("frozen_set: not a frozen_set file");
+		if (hdr.byte_order != byte_order || hdr.key_size != sizeof(_Key) || hdr.block_keys != block_keys)
+			throw std::runtime_error("frozen_set: file written for another key type or machine");
+		size_type height;
+		size_type nodes[max_layers + 1];
+		size_type index_keys = geometry(hdr.count, nodes, height);
+		size_type padded = round_up(hdr.count, block_keys);
+		if (hdr.index_keys != index_keys || hdr.keys_offset + padded * sizeof(_Key) > len
+				|| hdr.index_offset + index_keys * sizeof(_Key) > len)
+			throw std::runtime_error("frozen_set: file truncated or corrupt");
+		keys = reinterpret_cast<const _Key*>(base + hdr.keys_offset);
+		n = hdr.count;
+		layers = height;
+		layer_nodes[0] = nodes[0];
+		layer_keys[0] = keys;
+		const _Key* index = reinterpret_cast<const _Key*>(base + hdr.index_offset);
+		for (size_type h = layers; h > 0; --h) {
+			layer_nodes[h] = nodes[h];
+			layer_keys[h] = index;
+			index += nodes[h] * block_keys;
+		}
+	}
+
+	struct file_sink {
+		std::FILE* f;
+		explicit file_sink(std::FILE* _f) : f(_f) { }
+		void write(const void* p, size_type len) {
+			if (std::fwrite(p, 1, len, f) != len)
+				throw std::runtime_error("frozen_set: cannot write file");
+		}
+		void patch_header(const frozen_header& hdr) {
+			if (std::fseek(f, 0, SEEK_SET) != 0)
+				throw std::runtime_error("frozen_set: cannot write file");
+			write(&hdr, sizeof(hdr));
+		}
+	};
+
+	struct memory_sink {
+		std::vector<char>& buf;
+		explicit memory_sink(std::vector<char>& _buf) : buf(_buf) { }
+		void write(const void* p, size_type len) {
+			const char* c = static_cast<const char*>(p);
+			buf.insert(buf.end(), c, c + len);
+		}
+		void patch_header(const frozen_header& hdr) { std::memcpy(&buf[0], &hdr, sizeof(hdr)); }
+	};
+
+	template <typename _Sink>
+	static void write_padding(_Sink& sink, size_type& offset, size_type to) {
+		static const char zeros[cache_line_size] = { 0 };
+		size_type pad = round_up(offset, to) - offset;
+		sink.write(zeros, pad);
+		offset += pad;
+	}
+
+	/* the keys go out as they come, only the first key of every leaf block
+	 is kept to build the index afterwards */
+	template <typename _Sink, typename _InputIterator>
+	static void write_image(_Sink& sink, _InputIterator first, _InputIterator last) {
+		frozen_header hdr;
+		std::memset(&hdr, 0, sizeof(hdr));
+		sink.write(&hdr, sizeof(hdr));
+		size_type offset = sizeof(hdr);
+		write_padding(sink, offset, cache_line_size);
+		hdr.keys_offset = offset;
+
+		std::vector<_Key> firsts;
+		char last_key[sizeof(_Key)];
+		size_type count = 0;
+		for (; first != last; ++first, ++count) {
+			const _Key k = *first;
+			if (count % block_keys == 0)
+				firsts.push_back(k);
+			std::memcpy(last_key, &k, sizeof(_Key));
+			sink.write(last_key, sizeof(_Key));
+		}
+		for (size_type i = count; i < round_up(count, block_keys); ++i)
+			sink.write(last_key, sizeof(_Key));
+		offset += round_up(count, block_keys) * sizeof(_Key);
+		write_padding(sink, offset, cache_line_size);
+		hdr.index_offset = offset;
+
+		size_type height;
+		size_type nodes[max_layers + 1];
+		hdr.index_keys = geometry(count, nodes, height);
+		std::vector<size_type> stride(height + 1, 1); // leaf blocks under a node of each layer
+		for (size_type h = 1; h <= height; ++h)
+			stride[h] = stride[h - 1] * fanout;
+		for (size_type h = height; h > 0; --h) {
+			for (size_type j = 0; j < nodes[h]; ++j) {
+				for (size_type i = 0; i < block_keys; ++i) {
+					// missing children repeat the last separator
+					size_type c = std::min<size_type>(j * fanout + i + 1, nodes[h - 1] - 1);
+					sink.write(&firsts[c * stride[h - 1]], sizeof(_Key));
+				}
+			}
+		}
+
+		std::memcpy(hdr.magic, "yadsfrz", 8);
+		hdr.version = version;
+		hdr.byte_order = byte_order;
+		hdr.key_size = sizeof(_Key);
+		hdr.block_keys = block_keys;
+		hdr.count = count;
+		sink.patch_header(hdr);
+	}
+};
+
+template <typename _Key, typename _Compare>
+inline void swap(frozen_set<_Key, _Compare>& a, frozen_set<_Key, _Compare>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* FROZEN_SET_H_ */
@@ -0,0 +1,459 @@
+/*
+ * persistent_set.h
+ *
+ *  Persistent ordered set (C++11), readers never wait for writers
+ *  - an AVL tree of immutable nodes, insert and erase copy the path from
+ *    the root to the change and share every other subtree with the old
+ *    version, O(log n) new nodes per update
+ *  - snapshot: one version of the set, O(1) to take and to copy, its
+ *    insert / erase return a new snapshot and leave it untouched
+ *  - persistent_set: the current version behind an atomic root. Writers
+ *    take a mutex, build the new version aside and publish it with one
+ *    store, readers load the root and are never blocked
+ *  - nodes are reference counted, a version that nobody holds anymore goes
+ *    to the epoch domain (see epoch.h): lookups on persistent_set only pin
+ *    the epoch and never touch a counter
+ *  - no duplicates (acts like a set), iterators carry the path from the root
+ *
+ *  A snapshot and its iterators are a consistent point in time view, they
+ *  stay valid whatever happens to the set meanwhile. Every snapshot holds on
+ *  to the nodes of its version, drop old ones.
+ */
+
+#ifndef PERSISTENT_SET_H_
+#define PERSISTENT_SET_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <utility>
+
+#include "epoch.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key> >
+class persistent_set {
+	struct node {
+		std::atomic<std::size_t> refs; // parents, snapshots and the set's root
+		node* link[2];
+		int height; // leaves are 1
+		std::size_t size; // of the subtree
+		const _Key data;
+
+		node(const _Key& x, node* l, node* r) : refs(1), data(x) {
+			link[0] = l;
+			link[1] = r;
+			height = 1 + std::max(persistent_set::height(l), persistent_set::height(r));
+			size = 1 + persistent_set::size(l) + persistent_set::size(r);
+		}
+	};
+
+	enum { max_depth = sizeof(std::size_t) * 8 * 3 / 2 }; // AVL height bound, 1.44 log n
+
+public:
+	typedef _Key value_type;
+	typedef const _Key& reference;
+	typedef const _Key& const_reference;
+	typedef std::size_t size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	// the path from the root to the current node, end() has none
+	class iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : root(NULL), depth(0) { }
+		bool operator==(const iterator& other) const { return current() == other.current(); }
+		bool operator!=(const iterator& other) const { return current() != other.current(); }
+		iterator& operator++() { step(1); return *this; }
+		iterator& operator--() { step(0); return *this; }
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		iterator operator--(int) { iterator tmp(*this); --*this; return tmp; }
+		reference operator*() const { return current()->data; }
+		pointer operator->() const { return &current()->data; }
+	private:
+		friend class persistent_set;
+		explicit iterator(const node* _root) : root(_root), depth(0) { }
+
+		const node* current() const { return depth ? path[depth - 1] : NULL; }
+
+		void push_extreme(const node* n, int dir) {
+			for (; n; n = n->link[dir])
+				path[depth++] = n;
+		}
+
+		// in order successor for dir 1, predecessor for dir 0
+		void step(int dir) {
+			if (depth == 0) {
+				push_extreme(root, !dir); // --end() is the maximum
+				return;
+			}
+			const node* n = path[depth - 1]->link[dir];
+			if (n) {
+				path[depth++] = n;
+				push_extreme(n->link[!dir], !dir);
+				return;
+			}
+			// climb while we come from the dir side
+			const node* c;
+			do {
+				c = path[--depth];
+			} while (depth > 0 && path[depth - 1]->link[dir] == c);
+		}
+
+		const node* root;
+		unsigned depth;
+		const node* path[max_depth];
+	};
+
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	// one immutable version, safe to share between threads
+	class snapshot {
+	public:
+		explicit snapshot(const _Compare& comp = _Compare()) : root(NULL), m_comp(comp) { }
+		snapshot(const snapshot& other) : root(share(other.root)), m_comp(other.m_comp) { }
+		snapshot(snapshot&& other) : root(other.root), m_comp(other.m_comp) { other.root = NULL; }
+		~snapshot() { release_root(root); }
+
+		snapshot& operator=(snapshot other) {
+			swap(other);
+			return *this;
+		}
+
+		void swap(snapshot& other) {
+			using std::swap;
+			swap(root, other.root);
+			swap(m_comp, other.m_comp);
+		}
+
+		size_t size() const { return persistent_set::size(root); }
+		bool empty() const { return root == NULL; }
+		key_compare key_comp() const { return m_comp; }
+
+		// this version plus x, shares all but the path down to x
+		snapshot insert(const_reference x) const {
+			if (count(x))
+				return *this;
+			return snapshot(insert_node(root, x, m_comp), m_comp);
+		}
+
+		// this version without x
+		snapshot erase(const_reference x) const {
+			if (!count(x))
+				return *this;
+			return snapshot(erase_node(root, x, m_comp), m_comp);
+		}
+
+		size_t count(const_reference x) const { return contains(root, x, m_comp) ? 1 : 0; }
+
+		iterator find(const_reference x) const {
+			iterator it = lower_bound(x);
+			return (it.depth && !m_comp(x, *it)) ? it : end();
+		}
+
+		// first key not less than x
+		iterator lower_bound(const_reference x) const {
+			iterator it(root);
+			unsigned ge_depth = 0; // path length down to the last node not less than x
+			for (const node* n = root; n; ) {
+				it.path[it.depth++] = n;
+				if (m_comp(n->data, x)) {
+					n = n->link[1];
+				} else {
+					ge_depth = it.depth;
+					n = n->link[0];
+				}
+			}
+			it.depth = ge_depth;
+			return it;
+		}
+
+		// first key greater than x
+		iterator upper_bound(const_reference x) const {
+			iterator it(root);
+			unsigned gt_depth = 0;
+			for (const node* n = root; n; ) {
+				it.path[it.depth++] = n;
+				if (m_comp(x, n->data)) {
+					gt_depth = it.depth;
+					n = n->link[0];
+				} else {
+					n = n->link[1];
+				}
+			}
+			it.depth = gt_depth;
+			return it;
+		}
+
+		iterator begin() const {
+			iterator it(root);
+			it.push_extreme(root, 0);
+			return it;
+		}
+
+		iterator end() const { return iterator(root); }
+		reverse_iterator rbegin() const { return reverse_iterator(end()); }
+		reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	private:
+		friend class persistent_set;
+
+		// takes over the reference on _root
+		snapshot(node* _root, const _Compare& comp) : root(_root), m_comp(comp) { }
+
+		node* root;
+		_Compare m_comp;
+	};
+
+	explicit persistent_set(const _Compare& comp = _Compare()) : m_root(NULL), m_comp(comp) { }
+
+	// O(1), both sets start out sharing every node
+	persistent_set(const persistent_set& other) : m_root(NULL), m_comp(other.m_comp) {
+		snapshot s = other.current();
+		m_root.store(s.root, std::memory_order_relaxed);
+		s.root = NULL;
+	}
+
+	// not thread safe, nothing else may use the set by now
+	~persistent_set() { release_root(m_root.load(std::memory_order_relaxed)); }
+
+	// the current version, never blocks
+	snapshot current() const {
+		epoch_guard guard;
+		for (;;) {
+			node* r = m_root.load(std::memory_order_acquire);
+			// a zero count means a writer just replaced r, the new root is out
+			if (r == NULL || try_share(r))
+				return snapshot(r, m_comp);
+		}
+	}
+
+	// make s the current version, say to roll back to it
+	void restore(const snapshot& s) {
+		std::lock_guard<std::mutex> lock(writer);
+		publish(share(s.root));
+	}
+
+	// false if x was there already
+	bool insert(const_reference x) {
+		std::lock_guard<std::mutex> lock(writer);
+		node* r = m_root.load(std::memory_order_relaxed);
+		if (contains(r, x, m_comp))
+			return false;
+		publish(insert_node(r, x, m_comp));
+		return true;
+	}
+
+	size_t erase(const_reference x) {
+		std::lock_guard<std::mutex> lock(writer);
+		node* r = m_root.load(std::memory_order_relaxed);
+		if (!contains(r, x, m_comp))
+			return 0;
+		publish(erase_node(r, x, m_comp));
+		return 1;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(writer);
+		publish(NULL);
+	}
+
+	/* lookups on the current version, they only pin the epoch. Use a
+	 snapshot to look at the same version more than once */
+
+	size_t count(const_reference x) const {
+		epoch_guard guard;
+		return contains(m_root.load(std::memory_order_acquire), x, m_comp) ? 1 : 0;
+	}
+
+	size_t size() const {
+		epoch_guard guard;
+		return size(m_root.load(std::memory_order_acquire));
+	}
+
+	bool empty() const { return m_root.load(std::memory_order_acquire) == NULL; }
+
+	key_compare key_comp() const { return m_comp; }
+
+private:
+	std::atomic<node*> m_root; // holds one reference
+	_Compare m_comp;
+	std::mutex writer;
+
+	persistent_set& operator=(const persistent_set&);
+
+	static int height(const node* n) { return n ? n->height : 0; }
+	static std::size_t size(const node* n) { return n ? n->size : 0; }
+
+	// one more reference, the caller holds one already
+	static node* share(node* n) {
+		if (n)
+			n->refs.fetch_add(1, std::memory_order_relaxed);
+		return n;
+	}
+
+	// one more reference unless the count is down to zero already
+	static bool try_share(node* n) {
+		std::size_t refs = n->refs.load(std::memory_order_relaxed);
+		while (refs != 0) {
+			if (n->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	/* drop a reference to a node only its own versions can reach, they are
+	 gone by now, so the node and every kid nobody else holds go right away */
+	static void release(node* n) {
+		while (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			release(n->link[0]);
+			node* r = n->link[1];
+			delete n;
+			n = r;
+		}
+	}
+
+	// drop a reference to a root, lookups without a snapshot may still be on it
+	static void release_root(node* n) {
+		if (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			epoch_domain::instance().retire(n, &free_root);
+	}
+
+	static void free_root(void* p) {
+		node* n = static_cast<node*>(p);
+		n->refs.store(1, std::memory_order_relaxed);
+		release(n);
+	}
+
+	// writer only, takes over the reference on r
+	void publish(node* r) {
+		node* old = m_root.load(std::memory_order_relaxed);
+		m_root.store(r, std::memory_order_release);
+		release_root(old);
+	}
+
+	static bool contains(const node* n, const_reference x, const _Compare& comp) {
+		const node* ge = NULL; // last node not less than x
+		while (n) {
+			if (comp(n->data, x)) {
+				n = n->link[1];
+			} else {
+				ge = n;
+				n = n->link[0];
+			}
+		}
+		return ge && !comp(x, ge->data);
+	}
+
+	// a new node owning a reference on l and r, their references are dropped if it throws
+	static node* make(const _Key& x, node* l, node* r) {
+		try {
+			return new node(x, l, r);
+		} catch (...) {
+			release(l);
+			release(r);
+			throw;
+		}
+	}
+
+	// make with the kid a on the dir side and b on the other
+	static node* make(const _Key& x, int dir, node* a, node* b) {
+		return dir ? make(x, b, a) : make(x, a, b);
+	}
+
+	/* make for subtrees whose heights differ by up to two, rotates the
+	 heavy kid up if they differ by two. Only the rotated nodes are copied */
+	static node* balance(const _Key& x, node* l, node* r) {
+		int hl = height(l);
+		int hr = height(r);
+		if (hl <= hr + 1 && hr <= hl + 1)
+			return make(x, l, r);
+		int d = hl > hr ? 0 : 1; // heavy side
+		node* heavy = d ? r : l;
+		node* light = d ? l : r;
+		node* outer = heavy->link[d];
+		node* inner = heavy->link[!d];
+		node* down = NULL;
+		node* top;
+		try {
+			if (height(outer) >= height(inner)) {
+				// heavy goes up, x comes down with heavy's inner kid
+				down = make(x, d, share(inner), light);
+				node* t = down;
+				down = NULL;
+				top = make(heavy->data, d, share(outer), t);
+			} else {
+				// inner comes up between heavy and x
+				down = make(x, d, share(inner->link[!d]), light);
+				node* up = make(heavy->data, d, share(outer), share(inner->link[d]));
+				node* t = down;
+				down = NULL;
+				top = make(inner->data, d, up, t);
+			}
+		} catch (...) {
+			release(down);
+			release(heavy);
+			throw;
+		}
+		release(heavy);
+		return top;
+	}
+
+	// a new version of n with x, x is not in there
+	static node* insert_node(node* n, const_reference x, const _Compare& comp) {
+		if (!n)
+			return make(x, NULL, NULL);
+		if (comp(x, n->data)) {
+			node* l = insert_node(n->link[0], x, comp);
+			return balance(n->data, l, share(n->link[1]));
+		}
+		node* r = insert_node(n->link[1], x, comp);
+		return balance(n->data, share(n->link[0]), r);
+	}
+
+	// a new version of n without its minimum
+	static node* erase_min(node* n) {
+		if (!n->link[0])
+			return share(n->link[1]);
+		node* l = erase_min(n->link[0]);
+		return balance(n->data, l, share(n->link[1]));
+	}
+
+	// a new version of n without x, x is in there
+	static node* erase_node(node* n, const_reference x, const _Compare& comp) {
+		if (comp(x, n->data)) {
+			node* l = erase_node(n->link[0], x, comp);
+			return balance(n->data, l, share(n->link[1]));
+		}
+		if (comp(n->data, x)) {
+			node* r = erase_node(n->link[1], x, comp);
+			return balance(n->data, share(n->link[0]), r);
+		}
+		if (!n->link[0])
+			return share(n->link[1]);
+		if (!n->link[1])
+			return share(n->link[0]);
+		// the successor takes n's place, the old version keeps it alive meanwhile
+		const node* s = n->link[1];
+		while (s->link[0])
+			s = s->link[0];
+		node* r = erase_min(n->link[1]);
+		return balance(s->data, share(n->link[0]), r);
+	}
+};
+
+}; // namespace
+
+#endif /* PERSISTENT_SET_H_ */
@@ -0,0 +1,165 @@
+/*
+ * pool_allocator.h
+ *
+ *  Node pool allocator
+ *  - hands out single objects from contiguous chunks
+ *  - freed objects go to a free list and get reused first
+ *  - release() drops every chunk at once, O(chunks)
+ *
+ *  Every allocator instance owns its own pool, copies (and rebinds) start
+ *  empty. Containers keep one instance around (binary_search_tree keeps its
+ *  rebound node allocator) so that is all the sharing we need. Requests for
+ *  more than one object go straight to operator new.
+ */
+
+#ifndef POOL_ALLOCATOR_H_
+#define POOL_ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+#include <algorithm>
+
+namespace yadslib {
+
+template <typename _Tp, std::size_t _ChunkSize = 1024>
+class pool_allocator {
+public:
+	typedef _Tp value_type;
+	typedef _Tp* pointer;
+	typedef const _Tp* const_pointer;
+	typedef _Tp& reference;
+	typedef const _Tp& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template <typename _Up>
+	struct rebind { typedef pool_allocator<_Up, _ChunkSize> other; };
+
+	pool_allocator() : chunks(NULL), free_list(NULL), bump(NULL), bump_end(NULL), m_chunks(0) { }
+	pool_allocator(const pool_allocator&) : chunks(NULL), free_list(NULL), bump(NULL), bump_end(NULL), m_chunks(0) { }
+	template <typename _Up>
+	pool_allocator(const pool_allocator<_Up, _ChunkSize>&) : chunks(NULL), free_list(NULL), bump(NULL), bump_end(NULL), m_chunks(0) { }
+	~pool_allocator() { release(); }
+
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+
+	size_type max_size() const { return size_type(-1) / sizeof(_Tp); }
+
+	void construct(pointer p, const_reference val) { new (static_cast<void*>(p)) _Tp(val); }
+	void destroy(pointer p) { p->~_Tp(); }
+
+	pointer allocate(size_type n, const void* = 0) {
+		if (n != 1)
+			return static_cast<pointer>(::operator new(n * sizeof(_Tp)));
+		if (free_list) {
+			// recycle a freed slot
+			slot* s = free_list;
+			free_list = s->next;
+			return reinterpret_cast<pointer>(s);
+		}
+		if (bump == bump_end)
+			new_chunk();
+		slot* s = bump++;
+		return reinterpret_cast<pointer>(s);
+	}
+
+	void deallocate(pointer p, size_type n) {
+		if (n != 1) {
+			::operator delete(p);
+			return;
+		}
+		slot* s = reinterpret_cast<slot*>(p);
+		s->next = free_list;
+		free_list = s;
+	}
+
+	// free every chunk, whatever was handed out is gone (no destructors run)
+	void release() {
+		while (chunks) {
+			chunk* c = chunks;
+			chunks = c->next;
+			::operator delete(c);
+		}
+		free_list = bump = bump_end = NULL;
+		m_chunks = 0;
+	}
+
+	// number of chunks currently held
+	size_type chunk_count() const { return m_chunks; }
+
+	void swap(pool_allocator& other) {
+		std::swap(chunks, other.chunks);
+		std::swap(free_list, other.free_list);
+		std::swap(bump, other.bump);
+		std::swap(bump_end, other.bump_end);
+		std::swap(m_chunks, other.m_chunks);
+	}
+
+	// pools are never interchangeable, memory must go back where it came from
+	bool operator==(const pool_allocator& other) const { return this == &other; }
+	bool operator!=(const pool_allocator& other) const { return this != &other; }
+
+private:
+	// alignment of _Tp without C++11 alignof
+	struct align_probe { char c; _Tp t; };
+	enum {
+		tp_align = sizeof(align_probe) - sizeof(_Tp),
+		slot_align = (tp_align > sizeof(void*)) ? tp_align : sizeof(void*)
+	};
+
+	// a free slot holds the free list link, a used one holds a _Tp
+	union slot {
+		slot* next;
+		char storage[sizeof(_Tp)];
+	};
+
+	// chunk header, padded so the slots that follow keep _Tp's alignment
+	struct chunk {
+		chunk* next;
+	};
+	enum { header_size = ((sizeof(chunk) + slot_align - 1) / slot_align) * slot_align };
+
+	chunk* chunks;
+	slot* free_list;
+	slot* bump; // next never used slot of the newest chunk
+	slot* bump_end;
+	size_type m_chunks;
+
+	void new_chunk() {
+		char* mem = static_cast<char*>(::operator new(header_size + _ChunkSize * sizeof(slot)));
+		chunk* c = reinterpret_cast<chunk*>(mem);
+		c->next = chunks;
+		chunks = c;
+		bump = reinterpret_cast<slot*>(mem + header_size);
+		bump_end = bump + _ChunkSize;
+		++m_chunks;
+	}
+
+	pool_allocator& operator=(const pool_allocator&); // pools don't copy
+};
+
+template <typename _Tp, std::size_t _ChunkSize>
+inline void swap(pool_allocator<_Tp, _ChunkSize>& a, pool_allocator<_Tp, _ChunkSize>& b) {
+	a.swap(b);
+}
+
+/* bulk release hook for containers, release(a) returns true if a dropped
+ everything it ever handed out so the container can skip freeing its
+ nodes one by one */
+template <typename _Alloc>
+struct allocator_release {
+	static bool release(_Alloc&) { return false; }
+};
+
+template <typename _Tp, std::size_t _ChunkSize>
+struct allocator_release<pool_allocator<_Tp, _ChunkSize> > {
+	static bool release(pool_allocator<_Tp, _ChunkSize>& alloc) {
+		alloc.release();
+		return true;
+	}
+};
+
+}; // namespace
+
+#endif /* POOL_ALLOCATOR_H_ */
@@ -0,0 +1,361 @@
+/*
+ * skip_list.h
+ *
+ *  Lock-free skip list (C++11), a concurrent ordered set with
+ *  - insert / emplace / erase / find / count / lower_bound from any thread
+ *  - no locks, every update is a compare and swap on a link
+ *  - no duplicates (acts like a set), same interface as binary_search_tree
+ *  - weakly consistent forward iterators
+ *
+ *  Erase first marks the links of a node (the low bit of each next pointer),
+ *  top level down to level 0, then unlinks it. Marking level 0 is what
+ *  removes the key, whoever walks past a marked node helps unlinking it.
+ *  Unlinked nodes go to the epoch domain (see epoch.h) and are freed once no
+ *  thread can still hold them.
+ *
+ *  Iterators pin the epoch of their thread: they never dangle, see every key
+ *  that was there at creation and not erased since, may or may not see keys
+ *  inserted or erased meanwhile. Do not hand an iterator to another thread
+ *  and do not keep it around forever, it holds back reclamation.
+ *
+ *  Destruction is not thread safe, clear() is.
+ */
+
+#ifndef SKIP_LIST_H_
+#define SKIP_LIST_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "epoch.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key> >
+class skip_list {
+	enum { max_level = 32 };
+
+	typedef std::atomic<std::uintptr_t> link;
+
+	struct node {
+		typename std::aligned_storage<sizeof(_Key), alignof(_Key)>::type storage; // unused by the head
+		int level;
+		std::atomic<int> owners; // inserter and eraser, the last one to let go retires the node
+		link next[1]; // level links, allocated past the end
+
+		_Key& data() { return *reinterpret_cast<_Key*>(&storage); }
+	};
+
+	// the low bit of a link marks its owner as erased
+	static node* ptr(std::uintptr_t v) { return reinterpret_cast<node*>(v & ~std::uintptr_t(1)); }
+	static bool marked(std::uintptr_t v) { return v & 1; }
+	static std::uintptr_t as_link(node* n) { return reinterpret_cast<std::uintptr_t>(n); }
+	static bool erased(node* n) { return marked(n->next[0].load(std::memory_order_acquire)); }
+	static const _Key& key(node* n) { return n->data(); }
+
+public:
+	typedef _Key value_type;
+	typedef const _Key& reference;
+	typedef const _Key& const_reference;
+	typedef std::size_t size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	// a node at level 0, skips erased nodes as it goes
+	class iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : pnode(NULL) { }
+		iterator(const iterator& other) : pnode(other.pnode) { }
+		iterator& operator=(const iterator& other) { pnode = other.pnode; return *this; }
+		bool operator==(const iterator& other) const { return pnode == other.pnode; }
+		bool operator!=(const iterator& other) const { return pnode != other.pnode; }
+		iterator& operator++() {
+			pnode = skip_erased(ptr(pnode->next[0].load(std::memory_order_acquire)));
+			return *this;
+		}
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		reference operator*() const { return key(pnode); }
+		pointer operator->() const { return &key(pnode); }
+	private:
+		friend class skip_list;
+		explicit iterator(node* n) : pnode(n) { }
+		epoch_guard guard; // pnode stays allocated while we live
+		node* pnode;
+	};
+
+	typedef iterator const_iterator;
+
+	explicit skip_list(const _Compare& comp = _Compare())
+		: head(alloc_node(max_level)), m_level(1), m_size(0), m_comp(comp) {
+		for (int i = 0; i < max_level; ++i)
+			head->next[i].store(0, std::memory_order_relaxed);
+	}
+
+	~skip_list() {
+		node* n = ptr(head->next[0].load());
+		while (n) {
+			node* next = ptr(n->next[0].load());
+			free_node(n);
+			n = next;
+		}
+		::operator delete(head);
+	}
+
+	// exact when no update is running
+	size_type size() const { return m_size.load(std::memory_order_relaxed); }
+	bool empty() const { return ptr(head->next[0].load()) == NULL; }
+	key_compare key_comp() const { return m_comp; }
+
+	// erases one key after the other, other threads may keep inserting
+	void clear() {
+		epoch_guard guard;
+		for (node* n = first(); n; n = first())
+			erase(key(n));
+	}
+
+	std::pair<iterator, bool> insert(const _Key& x) { return insert_node(create_node(x)); }
+	std::pair<iterator, bool> insert(_Key&& x) { return insert_node(create_node(std::move(x))); }
+
+	template <typename... _Args>
+	std::pair<iterator, bool> emplace(_Args&&... args) {
+		return insert_node(create_node(std::forward<_Args>(args)...));
+	}
+
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_type erase(const _Key& x) {
+		epoch_guard guard;
+		node* preds[max_level];
+		node* succs[max_level];
+		if (!find_pos(x, preds, succs))
+			return 0;
+		node* n = succs[0];
+		for (int lvl = n->level - 1; lvl > 0; --lvl) {
+			std::uintptr_t v = n->next[lvl].load();
+			while (!marked(v) && !n->next[lvl].compare_exchange_weak(v, v | 1))
+				;
+		}
+		std::uintptr_t v = n->next[0].load();
+		for (;;) {
+			if (marked(v))
+				return 0; // another thread erased it first
+			if (n->next[0].compare_exchange_weak(v, v | 1))
+				break;
+		}
+		--m_size;
+		find_pos(x, preds, succs); // unlinks n on every level
+		release(n);
+		return 1;
+	}
+
+	size_type count(const _Key& x) const {
+		epoch_guard guard;
+		node* n = lower_bound_node(x);
+		return n && !m_comp(x, key(n));
+	}
+
+	iterator find(const _Key& x) const {
+		epoch_guard guard;
+		node* n = lower_bound_node(x);
+		return iterator(n && !m_comp(x, key(n)) ? n : NULL);
+	}
+
+	// first key not less than x
+	iterator lower_bound(const _Key& x) const {
+		epoch_guard guard;
+		return iterator(lower_bound_node(x));
+	}
+
+	iterator begin() const {
+		epoch_guard guard;
+		return iterator(first());
+	}
+
+	iterator end() const { return iterator(); }
+
+private:
+	node* head;
+	std::atomic<int> m_level; // levels in use, only grows
+	std::atomic<size_type> m_size;
+	_Compare m_comp;
+
+	skip_list(const skip_list&);
+	skip_list& operator=(const skip_list&);
+
+	static node* skip_erased(node* n) {
+		while (n && erased(n))
+			n = ptr(n->next[0].load(std::memory_order_acquire));
+		return n;
+	}
+
+	node* first() const { return skip_erased(ptr(head->next[0].load(std::memory_order_acquire))); }
+
+	// 1 + number of trailing ones of a random word, level k with odds 2^-k
+	static int random_level() {
+		static std::atomic<std::uint32_t> seeds(0x9e3779b9);
+		static thread_local std::uint32_t state = seeds.fetch_add(0x9e3779b9) | 1;
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		int level = 1;
+		for (std::uint32_t bits = state; (bits & 1) && level < max_level; bits >>= 1)
+			++level;
+		return level;
+	}
+
+	static node* alloc_node(int level) {
+		void* p = ::operator new(sizeof(node) + (level - 1) * sizeof(link));
+		node* n = new (p) node;
+		for (int i = 1; i < level; ++i)
+			new (&n->next[i]) link;
+		n->level = level;
+		n->owners.store(2, std::memory_order_relaxed);
+		return n;
+	}
+
+	template <typename... _Args>
+	static node* create_node(_Args&&... args) {
+		node* n = alloc_node(random_level());
+		try {
+			new (&n->storage) _Key(std::forward<_Args>(args)...);
+		} catch (...) {
+			::operator delete(n);
+			throw;
+		}
+		return n;
+	}
+
+	// the epoch domain deleter
+	static void free_node(void* p) {
+		node* n = static_cast<node*>(p);
+		n->data().~_Key();
+		::operator delete(p);
+	}
+
+	void release(node* n) {
+		if (n->owners.fetch_sub(1) == 1)
+			epoch_domain::instance().retire(n, free_node);
+	}
+
+	/* fills the last node before x and the first node not before x for every
+	 level in use, unlinking marked nodes on the way. False if some link
+	 changed under us and we have to start over */
+	bool try_find_pos(const _Key& x, node** preds, node** succs) {
+		node* pred = head;
+		for (int lvl = m_level.load() - 1; lvl >= 0; --lvl) {
+			node* curr = ptr(pred->next[lvl].load(std::memory_order_acquire));
+			while (curr) {
+				std::uintptr_t succ = curr->next[lvl].load(std::memory_order_acquire);
+				if (marked(succ)) {
+					std::uintptr_t expected = as_link(curr);
+					if (!pred->next[lvl].compare_exchange_strong(expected, succ & ~std::uintptr_t(1)))
+						return false;
+					curr = ptr(succ);
+				} else if (m_comp(key(curr), x)) {
+					pred = curr;
+					curr = ptr(succ);
+				} else {
+					break;
+				}
+			}
+			preds[lvl] = pred;
+			succs[lvl] = curr;
+		}
+		return true;
+	}
+
+	// true if x is in the list, in succs[0]
+	bool find_pos(const _Key& x, node** preds, node** succs) {
+		while (!try_find_pos(x, preds, succs))
+			;
+		return succs[0] && !m_comp(x, key(succs[0]));
+	}
+
+	// read only descent, walks over marked nodes instead of unlinking them
+	node* lower_bound_node(const _Key& x) const {
+		node* pred = head;
+		node* curr = NULL;
+		for (int lvl = m_level.load() - 1; lvl >= 0; --lvl) {
+			curr = ptr(pred->next[lvl].load(std::memory_order_acquire));
+			while (curr) {
+				std::uintptr_t succ = curr->next[lvl].load(std::memory_order_acquire);
+				if (marked(succ)) {
+					curr = ptr(succ);
+				} else if (m_comp(key(curr), x)) {
+					pred = curr;
+					curr = ptr(succ);
+				} else {
+					break;
+				}
+			}
+		}
+		return skip_erased(curr);
+	}
+
+	std::pair<iterator, bool> insert_node(node* n) {
+		epoch_guard guard;
+		int level = m_level.load();
+		while (level < n->level && !m_level.compare_exchange_weak(level, n->level))
+			;
+		node* preds[max_level];
+		node* succs[max_level];
+		for (;;) {
+			if (find_pos(key(n), preds, succs)) {
+				free_node(n); // never published
+				return std::make_pair(iterator(succs[0]), false);
+			}
+			for (int i = 0; i < n->level; ++i)
+				n->next[i].store(as_link(succs[i]), std::memory_order_relaxed);
+			std::uintptr_t expected = as_link(succs[0]);
+			if (preds[0]->next[0].compare_exchange_strong(expected, as_link(n)))
+				break;
+		}
+		++m_size;
+		// the key is in, the upper levels are only shortcuts
+		iterator it(n);
+		link_upper(n, preds, succs);
+		release(n);
+		return std::make_pair(it, true);
+	}
+
+	void link_upper(node* n, node** preds, node** succs) {
+		for (int lvl = 1; lvl < n->level; ++lvl) {
+			for (;;) {
+				std::uintptr_t v = n->next[lvl].load();
+				// a failed swap means an eraser marked the link
+				if (marked(v) || (ptr(v) != succs[lvl] && !n->next[lvl].compare_exchange_strong(v, as_link(succs[lvl]))))
+					goto done;
+				std::uintptr_t expected = as_link(succs[lvl]);
+				if (preds[lvl]->next[lvl].compare_exchange_strong(expected, as_link(n)))
+					break;
+				find_pos(key(n), preds, succs);
+				if (erased(n))
+					goto done;
+			}
+		}
+	done:
+		// an eraser may have unlinked n before we linked a level, clean up after it
+		if (erased(n))
+			find_pos(key(n), preds, succs);
+	}
+};
+
+}; // namespace
+
+#endif /* SKIP_LIST_H_ */
@@ -0,0 +1,284 @@
+/*
+ * suffix_array.h
+ *
+ *  Suffix array of a byte string with
+ *  - SA-IS construction, O(n) time, the recursion lives in the array itself
+ *  - Kasai LCP array, O(n)
+ *  - pattern search by binary search over the suffixes, comparisons resume
+ *    after the prefix the pattern shares with both ends of the range
+ *  - _Index sized entries, 32 bits by default: 4n bytes for the array and
+ *    4n for the LCP, next to 20n or more for a pointer based suffix tree
+ *
+ *  The text is not copied, it has to outlive the suffix array.
+ */
+
+#ifndef SUFFIX_ARRAY_H_
+#define SUFFIX_ARRAY_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace yadslib {
+
+template <typename _Index = unsigned int>
+class suffix_array {
+public:
+	typedef _Index index_type;
+	typedef std::size_t size_type;
+
+	suffix_array() : text(NULL), n(0) { }
+
+	suffix_array(const char* _text, size_type _n) : text(NULL), n(0) { build(_text, _n); }
+
+	explicit suffix_array(const std::string& _text) : text(NULL), n(0) { build(_text.data(), _text.size()); }
+
+	// throws std::length_error if _Index cannot hold every position
+	void build(const char* _text, size_type _n) {
+		// one more for the sentinel suffix and one for the empty marker
+		if (_n > static_cast<size_type>(no_suffix) - 2)
+			throw std::length_error("suffix_array: text too long for the index type");
+		text = reinterpret_cast<const unsigned char*>(_text);
+		n = _n;
+		std::vector<_Index>().swap(sa);
+		std::vector<_Index>().swap(lcps);
+		if (n == 0)
+			return;
+		sa.resize(n + 1);
+		byte_text s(text, n);
+		sais(s, &sa[0], n + 1, 256);
+		sa.erase(sa.begin()); // the sentinel suffix comes first
+		build_lcp();
+	}
+
+	size_type size() const { return n; }
+	bool empty() const { return n == 0; }
+
+	// start of the i-th smallest suffix
+	index_type operator[](size_type i) const { return sa[i]; }
+
+	const std::vector<_Index>& array() const { return sa; }
+
+	// lcp()[i] is the common prefix length of suffixes i - 1 and i, lcp()[0] is 0
+	const std::vector<_Index>& lcp() const { return lcps; }
+
+	// ranks [first, second) of the suffixes that start with the pattern
+	std::pair<size_type, size_type> equal_range(const char* pattern, size_type m) const {
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(pattern);
+		size_type first = bound(p, m, false);
+		return std::make_pair(first, bound(p, m, true, first));
+	}
+
+	std::pair<size_type, size_type> equal_range(const std::string& pattern) const {
+		return equal_range(pattern.data(), pattern.size());
+	}
+
+	size_type count(const char* pattern, size_type m) const {
+		std::pair<size_type, size_type> r = equal_range(pattern, m);
+		return r.second - r.first;
+	}
+
+	size_type count(const std::string& pattern) const { return count(pattern.data(), pattern.size()); }
+
+	// where the pattern occurs, in suffix order
+	template <typename _OutputIterator>
+	_OutputIterator find_all(const char* pattern, size_type m, _OutputIterator out) const {
+		std::pair<size_type, size_type> r = equal_range(pattern, m);
+		return std::copy(sa.begin() + r.first, sa.begin() + r.second, out);
+	}
+
+	template <typename _OutputIterator>
+	_OutputIterator find_all(const std::string& pattern, _OutputIterator out) const {
+		return find_all(pattern.data(), pattern.size(), out);
+	}
+
+private:
+	static const _Index no_suffix = static_cast<_Index>(~static_cast<_Index>(0));
+
+	const unsigned char* text;
+	size_type n;
+	std::vector<_Index> sa;
+	std::vector<_Index> lcps;
+
+	// the text shifted up by one with a virtual 0 sentinel at the end
+	struct byte_text {
+		const unsigned char* s;
+		size_type n;
+		byte_text(const unsigned char* _s, size_type _n) : s(_s), n(_n) { }
+		_Index operator[](size_type i) const { return i == n ? 0 : s[i] + 1; }
+	};
+
+	// the reduced problem, its last name is the unique sentinel 0
+	struct index_text {
+		const _Index* s;
+		explicit index_text(const _Index* _s) : s(_s) { }
+		_Index operator[](size_type i) const { return s[i]; }
+	};
+
+	// true for S type positions: suffix i is smaller than suffix i + 1
+	typedef std::vector<bool> types;
+
+	static bool is_lms(const types& t, size_type i) { return i > 0 && t[i] && !t[i - 1]; }
+
+	// bucket starts, or ends if end is set, for the K + 1 symbols
+	template <typename _Text>
+	static void get_buckets(const _Text& s, size_type len, std::vector<_Index>& bkt, bool end) {
+		std::fill(bkt.begin(), bkt.end(), 0);
+		for (size_type i = 0; i < len; ++i)
+			++bkt[s[i]];
+		_Index sum = 0;
+		for (size_type i = 0; i < bkt.size(); ++i) {
+			sum += bkt[i];
+			bkt[i] = end ? sum : sum - bkt[i];
+		}
+	}
+
+	// L type suffixes from the sorted ones left to right, then S type right to left
+	template <typename _Text>
+	static void induce(const _Text& s, _Index* SA, size_type len, const types& t, std::vector<_Index>& bkt) {
+		get_buckets(s, len, bkt, false);
+		for (size_type i = 0; i < len; ++i) {
+			if (SA[i] != no_suffix && SA[i] > 0 && !t[SA[i] - 1])
+				SA[bkt[s[SA[i] - 1]]++] = SA[i] - 1;
+		}
+		get_buckets(s, len, bkt, true);
+		for (size_type i = len; i-- > 0; ) {
+			if (SA[i] != no_suffix && SA[i] > 0 && t[SA[i] - 1])
+				SA[--bkt[s[SA[i] - 1]]] = SA[i] - 1;
+		}
+	}
+
+	/* Nong, Zhang and Chan's SA-IS. s[len - 1] is a unique smallest
+	 sentinel, symbols are in [0, K]. The reduced string and its suffix array
+	 both fit in SA while it is not needed for anything else */
+	template <typename _Text>
+	static void sais(const _Text& s, _Index* SA, size_type len, size_type K) {
+		types t(len);
+		t[len - 1] = true;
+		for (size_type i = len - 1; i-- > 0; )
+			t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+
+		// sort the LMS substrings
+		std::vector<_Index> bkt(K + 1);
+		get_buckets(s, len, bkt, true);
+		std::fill(SA, SA + len, no_suffix);
+		for (size_type i = 1; i < len; ++i) {
+			if (is_lms(t, i))
+				SA[--bkt[s[i]]] = i;
+		}
+		induce(s, SA, len, t, bkt);
+
+		// move them to the front and name them, equal substrings get equal names
+		size_type n1 = 0;
+		for (size_type i = 0; i < len; ++i) {
+			if (SA[i] != no_suffix && is_lms(t, SA[i]))
+				SA[n1++] = SA[i];
+		}
+		std::fill(SA + n1, SA + len, no_suffix);
+		_Index name = 0;
+		size_type prev = len;
+		for (size_type i = 0; i < n1; ++i) {
+			size_type pos = SA[i];
+			bool diff = prev == len;
+			for (size_type d = 0; !diff; ++d) {
+				if (s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d])
+					diff = true;
+				else if (d > 0 && (is_lms(t, pos + d) || is_lms(t, prev + d)))
+					break;
+			}
+			if (diff) {
+				++name;
+				prev = pos;
+			}
+			SA[n1 + pos / 2] = name - 1; // LMS positions are at least 2 apart
+		}
+		for (size_type i = len, j = len; i-- > n1; ) {
+			if (SA[i] != no_suffix)
+				SA[--j] = SA[i];
+		}
+
+		// sort the reduced string, directly if every name is unique
+		_Index* SA1 = SA;
+		_Index* s1 = SA + len - n1;
+		if (name < n1) {
+			sais(index_text(s1), SA1, n1, name - 1);
+		} else {
+			for (size_type i = 0; i < n1; ++i)
+				SA1[s1[i]] = i;
+		}
+
+		// put the LMS suffixes in their order at the ends of the buckets and induce the rest
+		get_buckets(s, len, bkt, true);
+		for (size_type i = 1, j = 0; i < len; ++i) {
+			if (is_lms(t, i))
+				s1[j++] = i;
+		}
+		for (size_type i = 0; i < n1; ++i)
+			SA1[i] = s1[SA1[i]];
+		std::fill(SA + n1, SA + len, no_suffix);
+		for (size_type i = n1; i-- > 0; ) {
+			_Index j = SA[i];
+			SA[i] = no_suffix;
+			SA[--bkt[s[j]]] = j;
+		}
+		induce(s, SA, len, t, bkt);
+	}
+
+	/* Kasai et al. Walks the text in order, the common prefix with the
+	 previous suffix in the array drops by at most one per step */
+	void build_lcp() {
+		std::vector<_Index> rank(n);
+		for (size_type i = 0; i < n; ++i)
+			rank[sa[i]] = i;
+		lcps.assign(n, 0);
+		size_type h = 0;
+		for (size_type i = 0; i < n; ++i) {
+			if (rank[i] == 0) {
+				h = 0;
+				continue;
+			}
+			size_type j = sa[rank[i] - 1];
+			while (i + h < n && j + h < n && text[i + h] == text[j + h])
+				++h;
+			lcps[rank[i]] = h;
+			if (h > 0)
+				--h;
+		}
+	}
+
+	/* first rank whose suffix is not less than the pattern, or with after
+	 set, the first one that is greater and does not start with it. The
+	 suffixes between two others share at least the prefix both ends share
+	 with the pattern, so comparisons resume after it */
+	size_type bound(const unsigned char* p, size_type m, bool after, size_type l = 0) const {
+		size_type r = n;
+		size_type lcp_l = 0; // with the suffix before l
+		size_type lcp_r = 0; // with the suffix at r
+		while (l < r) {
+			size_type mid = l + (r - l) / 2;
+			size_type pos = sa[mid];
+			size_type k = std::min(lcp_l, lcp_r);
+			while (k < m && pos + k < n && text[pos + k] == p[k])
+				++k;
+			bool before = k == m ? after : (pos + k == n || text[pos + k] < p[k]);
+			if (before) {
+				l = mid + 1;
+				lcp_l = k;
+			} else {
+				r = mid;
+				lcp_r = k;
+			}
+		}
+		return l;
+	}
+};
+
+template <typename _Index>
+const _Index suffix_array<_Index>::no_suffix;
+
+}; // namespace
+
+#endif /* SUFFIX_ARRAY_H_ */
@@ -0,0 +1,393 @@
+/*
+ * suffix_tree.h
+ *
+ *  Generalized suffix tree of byte strings with
+ *  - Ukkonen's online construction, O(1) amortized per appended byte, the
+ *    text can grow at any time and is searchable in between
+ *  - several documents: end_document() appends a terminator that matches
+ *    nothing, no match runs from one document into the next
+ *  - edges stored as [start, end) positions into the text, leaves grow
+ *    with it through an open end
+ *  - children found through one open addressing table keyed by
+ *    (node, symbol) for the whole tree, no per node maps. Siblings are
+ *    also chained for the walks over subtrees
+ *  - substring search in O(m), occurrence count in O(m + occurrences)
+ *    and the longest repeated substring in O(n)
+ *  - _Index sized fields, 32 bits by default: texts up to 2^31 - 1 bytes,
+ *    at most 2n + 1 nodes of 20 bytes and fewer than 3 table slots of 12 bytes per node. memory()
+ *    tells the actual figure, about 95 bytes per byte of random DNA with
+ *    the slack of the growing vectors
+ *
+ *  The tree keeps its own copy of the text. The last suffixes that also
+ *  occur earlier in the text have no leaf yet (Ukkonen's remainder),
+ *  count() looks for the pattern among them too.
+ */
+
+#ifndef SUFFIX_TREE_H_
+#define SUFFIX_TREE_H_
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace yadslib {
+
+template <typename _Index = unsigned int>
+class suffix_tree {
+public:
+	typedef _Index index_type;
+	typedef std::size_t size_type;
+
+	suffix_tree() { reset(); }
+
+	explicit suffix_tree(const std::string& _text) {
+		reset();
+		append(_text);
+	}
+
+	void clear() { reset(); }
+
+	// throws std::length_error if _Index cannot hold every position
+	void append(const char* s, size_type n) {
+		if (n > max_length - text.size())
+			throw std::length_error("suffix_tree: text too long for the index type");
+		for (size_type i = 0; i < n; ++i) {
+			text.push_back(s[i]);
+			separator.push_back(false);
+			extend();
+		}
+	}
+
+	void append(const std::string& s) { append(s.data(), s.size()); }
+
+	// close the current document, every suffix of the text gets its leaf
+	void end_document() {
+		if (text.size() == max_length)
+			throw std::length_error("suffix_tree: text too long for the index type");
+		text.push_back('\0');
+		separator.push_back(true);
+		extend();
+	}
+
+	// bytes appended so far, a terminator counts as one
+	size_type size() const { return text.size(); }
+	bool empty() const { return text.empty(); }
+
+	const std::string& str() const { return text; }
+
+	size_type node_count() const { return nodes.size(); }
+
+	// bytes held for the text, the nodes and the child table
+	size_type memory() const {
+		return text.capacity() + separator.capacity() / 8 + nodes.capacity() * sizeof(node)
+			+ slots.capacity() * sizeof(slot);
+	}
+
+	bool contains(const char* pattern, size_type m) const {
+		size_type depth;
+		return locate(reinterpret_cast<const unsigned char*>(pattern), m, depth) != no_node;
+	}
+
+	bool contains(const std::string& pattern) const { return contains(pattern.data(), pattern.size()); }
+
+	// occurrences of the pattern, overlapping ones too
+	size_type count(const char* pattern, size_type m) const {
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(pattern);
+		if (m == 0)
+			return text.size();
+		size_type depth;
+		_Index n = locate(p, m, depth);
+		if (n == no_node)
+			return 0;
+		return leaves(n) + count_pending(p, m);
+	}
+
+	size_type count(const std::string& pattern) const { return count(pattern.data(), pattern.size()); }
+
+	/* start and length of a longest substring that occurs at least twice,
+	 (0, 0) if there is none. The deepest branching node or the pending
+	 suffixes, which all occur earlier */
+	std::pair<size_type, size_type> longest_repeat() const {
+		std::pair<size_type, size_type> best(0, 0);
+		if (remainder > 0)
+			best = std::make_pair(text.size() - remainder, size_type(remainder));
+		std::vector<std::pair<_Index, size_type> > stack; // node and the depth above its edge
+		for (_Index k = nodes[root].kid; k != no_node; k = nodes[k].next)
+			stack.push_back(std::make_pair(k, size_type(0)));
+		while (!stack.empty()) {
+			_Index n = stack.back().first;
+			size_type above = stack.back().second;
+			stack.pop_back();
+			const node& nd = nodes[n];
+			if (nd.kid == no_node)
+				continue; // leaves occur once
+			size_type depth = above + nd.end - nd.start;
+			if (depth > best.second)
+				best = std::make_pair(nd.start - above, depth);
+			for (_Index k = nd.kid; k != no_node; k = nodes[k].next)
+				stack.push_back(std::make_pair(k, depth));
+		}
+		return best;
+	}
+
+	std::string longest_repeated_substring() const {
+		std::pair<size_type, size_type> r = longest_repeat();
+		return text.substr(r.first, r.second);
+	}
+
+private:
+	static const _Index no_node = static_cast<_Index>(~static_cast<_Index>(0));
+	static const _Index open_end = no_node; // a leaf, its edge runs to the end of the text
+	static const _Index root = 0;
+
+	/* terminators are symbols 256 + position and a text of n bytes takes up
+	 to 2n + 1 nodes, all of them numbered below no_node */
+	static const size_type symbol_limit = static_cast<size_type>(no_node) - 256;
+	static const size_type node_limit = (static_cast<size_type>(no_node) - 1) / 2;
+	static const size_type max_length = symbol_limit < node_limit ? symbol_limit : node_limit;
+
+	// the node at the lower end of the edge [start, end)
+	struct node {
+		_Index start;
+		_Index end;
+		_Index link; // suffix link, internal nodes only
+		_Index kid; // first child
+		_Index next; // next sibling
+	};
+
+	// (parent, symbol) -> child, empty if parent is no_node
+	struct slot {
+		_Index parent;
+		_Index symbol;
+		_Index child;
+	};
+
+	std::string text;
+	std::vector<bool> separator; // true at the terminators
+	std::vector<node> nodes;
+	std::vector<slot> slots; // a power of two, at most 3 / 4 full
+	size_type used;
+
+	// Ukkonen's active point: remainder pending suffixes, the longest one
+	// ends active_length symbols down the edge of active_node starting with the symbol at active_edge
+	_Index active_node;
+	size_type active_edge;
+	size_type active_length;
+	size_type remainder;
+
+	void reset() {
+		text.clear();
+		separator.clear();
+		nodes.clear();
+		slots.assign(16, empty_slot());
+		used = 0;
+		new_node(0, 0);
+		active_node = root;
+		active_edge = active_length = remainder = 0;
+	}
+
+	static slot empty_slot() {
+		slot s = { no_node, 0, no_node };
+		return s;
+	}
+
+	_Index symbol(size_type pos) const {
+		return separator[pos] ? static_cast<_Index>(256 + pos) : static_cast<unsigned char>(text[pos]);
+	}
+
+	size_type edge_end(const node& nd) const { return nd.end == open_end ? text.size() : nd.end; }
+	size_type edge_length(_Index n) const { return edge_end(nodes[n]) - nodes[n].start; }
+
+	_Index new_node(size_type start, _Index end) {
+		node nd = { static_cast<_Index>(start), end, root, no_node, no_node };
+		nodes.push_back(nd);
+		return static_cast<_Index>(nodes.size() - 1);
+	}
+
+	static size_type hash(_Index parent, _Index sym) {
+		unsigned long long h = (static_cast<unsigned long long>(parent) << 32 ^ sym) * 0x9e3779b97f4a7c15ULL;
+		return static_cast<size_type>(h >> 29);
+	}
+
+	// the slot of (parent, sym) or the empty one where it would go
+	size_type find_slot(_Index parent, _Index sym) const {
+		size_type mask = slots.size() - 1;
+		size_type i = hash(parent, sym) & mask;
+		while (slots[i].parent != no_node && (slots[i].parent != parent || slots[i].symbol != sym))
+			i = (i + 1) & mask;
+		return i;
+	}
+
+	_Index child(_Index parent, _Index sym) const { return slots[find_slot(parent, sym)].child; }
+
+	// add or replace the edge out of parent starting with sym
+	void set_child(_Index parent, _Index sym, _Index kid) {
+		size_type i = find_slot(parent, sym);
+		if (slots[i].parent == no_node) {
+			if ((used + 1) * 4 > slots.size() * 3) {
+				grow();
+				i = find_slot(parent, sym);
+			}
+			slots[i].parent = parent;
+			slots[i].symbol = sym;
+			++used;
+		}
+		slots[i].child = kid;
+	}
+
+	void grow() {
+		std::vector<slot> old(slots.size() * 2, empty_slot());
+		old.swap(slots);
+		for (size_type j = 0; j < old.size(); ++j) {
+			if (old[j].parent != no_node)
+				slots[find_slot(old[j].parent, old[j].symbol)] = old[j];
+		}
+	}
+
+	void add_kid(_Index parent, _Index kid) {
+		set_child(parent, symbol(nodes[kid].start), kid);
+		nodes[kid].next = nodes[parent].kid;
+		nodes[parent].kid = kid;
+	}
+
+	// kid takes the place of old among the children of parent
+	void replace_kid(_Index parent, _Index old, _Index kid) {
+		set_child(parent, symbol(nodes[kid].start), kid);
+		nodes[kid].next = nodes[old].next;
+		_Index* p = &nodes[parent].kid;
+		while (*p != old)
+			p = &nodes[*p].next;
+		*p = kid;
+	}
+
+	// one phase of Ukkonen's algorithm for the last symbol of the text
+	void extend() {
+		size_type pos = text.size() - 1;
+		_Index c = symbol(pos);
+		_Index last_split = no_node; // waits for its suffix link
+		++remainder;
+		while (remainder > 0) {
+			if (active_length == 0)
+				active_edge = pos;
+			_Index sym = symbol(active_edge);
+			_Index next = child(active_node, sym);
+			if (next == no_node) {
+				add_kid(active_node, new_node(pos, open_end));
+				if (last_split != no_node) {
+					nodes[last_split].link = active_node;
+					last_split = no_node;
+				}
+			} else {
+				size_type len = edge_length(next);
+				if (active_length >= len) {
+					// the active point is past this edge, walk down
+					active_edge += len;
+					active_length -= len;
+					active_node = next;
+					continue;
+				}
+				if (symbol(nodes[next].start + active_length) == c) {
+					// the suffix is there already, so are all shorter ones
+					if (last_split != no_node && active_node != root) {
+						nodes[last_split].link = active_node;
+						last_split = no_node;
+					}
+					++active_length;
+					break;
+				}
+				_Index split = new_node(nodes[next].start, static_cast<_Index>(nodes[next].start + active_length));
+				replace_kid(active_node, next, split);
+				nodes[next].start += static_cast<_Index>(active_length);
+				add_kid(split, next);
+				add_kid(split, new_node(pos, open_end));
+				if (last_split != no_node)
+					nodes[last_split].link = split;
+				last_split = split;
+			}
+			--remainder;
+			if (active_node == root && active_length > 0) {
+				--active_length;
+				active_edge = pos - remainder + 1;
+			} else if (active_node != root) {
+				active_node = nodes[active_node].link;
+			}
+		}
+	}
+
+	/* the node at or below the end of the pattern's path, no_node if the
+	 pattern is not in the text. depth is the length of that node's path */
+	_Index locate(const unsigned char* p, size_type m, size_type& depth) const {
+		_Index n = root;
+		depth = 0;
+		size_type i = 0;
+		while (i < m) {
+			n = child(n, p[i]);
+			if (n == no_node)
+				return no_node;
+			const node& nd = nodes[n];
+			size_type end = edge_end(nd);
+			for (size_type j = nd.start; j < end && i < m; ++j, ++i) {
+				if (separator[j] || static_cast<unsigned char>(text[j]) != p[i])
+					return no_node;
+			}
+			depth += end - nd.start;
+		}
+		return n;
+	}
+
+	// leaves below n, the number of suffixes starting with its path
+	size_type leaves(_Index n) const {
+		size_type count = 0;
+		std::vector<_Index> stack(1, n);
+		while (!stack.empty()) {
+			_Index k = stack.back();
+			stack.pop_back();
+			if (nodes[k].kid == no_node)
+				++count;
+			for (_Index kid = nodes[k].kid; kid != no_node; kid = nodes[kid].next)
+				stack.push_back(kid);
+		}
+		return count;
+	}
+
+	/* the pattern at the start of the pending suffixes, they lie within the
+	 last remainder bytes: Knuth-Morris-Pratt over those */
+	size_type count_pending(const unsigned char* p, size_type m) const {
+		if (remainder < m)
+			return 0;
+		std::vector<size_type> fail(m + 1, 0);
+		for (size_type i = 1, k = 0; i < m; ++i) {
+			while (k > 0 && p[i] != p[k])
+				k = fail[k];
+			if (p[i] == p[k])
+				++k;
+			fail[i + 1] = k;
+		}
+		size_type count = 0;
+		for (size_type i = text.size() - remainder, k = 0; i < text.size(); ++i) {
+			unsigned char c = static_cast<unsigned char>(text[i]);
+			while (k > 0 && (k == m || c != p[k]))
+				k = fail[k];
+			if (c == p[k])
+				++k;
+			if (k == m)
+				++count;
+		}
+		return count;
+	}
+};
+
+template <typename _Index>
+const _Index suffix_tree<_Index>::no_node;
+
+template <typename _Index>
+const _Index suffix_tree<_Index>::open_end;
+
+template <typename _Index>
+const _Index suffix_tree<_Index>::root;
+
+}; // namespace
+
+#endif /* SUFFIX_TREE_H_ */
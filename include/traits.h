@@ -0,0 +1,141 @@
+/*
+ * traits.h
+ *
+ *  Small compile time helpers shared by the containers, written so they
+ *  also work without C++11
+ */
+
+#ifndef TRAITS_H_
+#define TRAITS_H_
+
+#include <cstddef>
+#include <functional>
+#include <limits>
+
+#if __cplusplus >= 201103L
+#include <type_traits>
+#include <utility>
+#endif
+
+namespace yadslib {
+
+// tag for constructors taking a range that is sorted and free of duplicates
+struct sorted_unique_t { };
+static const sorted_unique_t sorted_unique = sorted_unique_t();
+
+namespace detail {
+
+template <bool _Cond, typename _Tp = void>
+struct enable_if { };
+
+template <typename _Tp>
+struct enable_if<true, _Tp> { typedef _Tp type; };
+
+// a compile time bool to pick overloads with
+template <bool _Value>
+struct bool_tag { static const bool value = _Value; };
+
+// true if _Compare declares is_transparent (std::less<> and friends)
+template <typename _Compare>
+struct has_is_transparent {
+private:
+	template <typename _Up> static char test(typename _Up::is_transparent*);
+	template <typename _Up> static long test(...);
+public:
+	static const bool value = sizeof(test<_Compare>(0)) == sizeof(char);
+};
+
+/* enable heterogeneous lookup with a _Lookup key only for transparent
+ comparators, depending on _Lookup keeps it SFINAE friendly inside class
+ templates */
+template <typename _Compare, typename _Lookup, typename _Tp>
+struct enable_transparent : enable_if<has_is_transparent<_Compare>::value, _Tp> { };
+
+// keys that need no destructor call can be dropped along with their memory
+template <typename _Tp>
+struct is_trivially_destructible {
+#if __cplusplus >= 201103L
+	static const bool value = std::is_trivially_destructible<_Tp>::value;
+#elif defined(__GNUC__)
+	static const bool value = __has_trivial_destructor(_Tp);
+#else
+	static const bool value = false;
+#endif
+};
+
+// keys that can be copied as bytes, memcpy instead of a copy constructor
+template <typename _Tp>
+struct is_trivially_copyable {
+#if __cplusplus >= 201103L
+	static const bool value = std::is_trivially_copyable<_Tp>::value;
+#elif defined(__GNUC__)
+	static const bool value = __has_trivial_copy(_Tp) && __has_trivial_destructor(_Tp);
+#else
+	static const bool value = false;
+#endif
+};
+
+// integers, floating point numbers, enums and pointers
+template <typename _Tp>
+struct is_scalar {
+#if __cplusplus >= 201103L
+	static const bool value = std::is_scalar<_Tp>::value;
+#elif defined(__GNUC__)
+	static const bool value = (std::numeric_limits<_Tp>::is_specialized || __is_enum(_Tp)) && __is_pod(_Tp);
+#else
+	static const bool value = std::numeric_limits<_Tp>::is_specialized;
+#endif
+};
+
+template <typename _Tp>
+struct is_scalar<_Tp*> { static const bool value = true; };
+
+/* scalar keys under std::less or std::greater compare in one instruction,
+ searches then pick the next node from the outcome instead of branching */
+template <typename _Key, typename _Compare>
+struct has_cheap_compare { static const bool value = false; };
+
+template <typename _Key>
+struct has_cheap_compare<_Key, std::less<_Key> > { static const bool value = is_scalar<_Key>::value; };
+
+template <typename _Key>
+struct has_cheap_compare<_Key, std::greater<_Key> > { static const bool value = is_scalar<_Key>::value; };
+
+/* raw storage for _N objects of _Tp, constructing and destroying them is up
+ to the owner. Aligned for any fundamental type, which is what we can do
+ without C++11 alignas */
+template <typename _Tp, std::size_t _N>
+struct uninitialized_array {
+	union {
+		char bytes[sizeof(_Tp) * _N];
+		long double ld;
+		long long ll;
+		void* p;
+	} storage;
+
+	_Tp* data() { return reinterpret_cast<_Tp*>(storage.bytes); }
+	const _Tp* data() const { return reinterpret_cast<const _Tp*>(storage.bytes); }
+};
+
+// hint that p will be read soon, nothing where the compiler has no builtin
+inline void prefetch(const void* p) {
+#if defined(__GNUC__)
+	__builtin_prefetch(p);
+#else
+	(void)p;
+#endif
+}
+
+// std::move when we have it, a plain copy otherwise
+#if __cplusplus >= 201103L
+template <typename _Tp>
+typename std::remove_reference<_Tp>::type&& move(_Tp&& x) { return std::move(x); }
+#else
+template <typename _Tp>
+const _Tp& move(const _Tp& x) { return x; }
+#endif
+
+}; // namespace detail
+}; // namespace
+
+#endif /* TRAITS_H_ */
@@ -0,0 +1,601 @@
+/*
+ * treap.h
+ *
+ *  Treap, a binary search tree kept balanced by random heap priorities, with
+ *  - O(log n) expected insert, erase and lookups
+ *  - O(log n) split() at a key and join() of two ordered treaps
+ *  - union, intersection and difference of whole treaps built from split
+ *    and join: O(m log(n / m + 1)) for sizes m <= n instead of m lookups
+ *    or inserts, and with C++11 the two halves of big subproblems run in
+ *    parallel, they cover disjoint key ranges so they never touch the
+ *    same node
+ *  - subtree sizes and parent pointers in every node, O(1) size() after a
+ *    split, bidirectional iterators
+ *  - no duplicates (acts like a set), same interface as binary_search_tree
+ *
+ *  split, join and the set operations move nodes between treaps, the
+ *  allocators of both sides must compare equal. The set operations need a
+ *  comparator that does not throw.
+ */
+
+#ifndef TREAP_H_
+#define TREAP_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <future>
+#include <thread>
+#endif
+
+#include "traits.h"
+
+namespace yadslib {
+
+template <typename _Key, typename _Compare = std::less<_Key>, typename _Alloc = std::allocator<_Key> >
+class treap {
+	struct node {
+		node* parent;
+		node* left;
+		node* right;
+		unsigned priority; // never below any descendant's
+		std::size_t size; // nodes in this subtree
+		_Key data;
+	};
+
+	static const _Key& key(const node* n) { return n->data; }
+	static std::size_t size(const node* n) { return n ? n->size : 0; }
+
+	static node* left_most(node* n) {
+		while (n->left)
+			n = n->left;
+		return n;
+	}
+
+	static node* right_most(node* n) {
+		while (n->right)
+			n = n->right;
+		return n;
+	}
+
+public:
+	typedef _Alloc allocator_type;
+	typedef typename _Alloc::value_type value_type;
+	typedef typename _Alloc::reference reference;
+	typedef typename _Alloc::const_reference const_reference;
+	typedef typename _Alloc::pointer pointer;
+	typedef typename _Alloc::const_pointer const_pointer;
+	typedef typename _Alloc::size_type size_type;
+	typedef _Key key_type;
+	typedef _Compare key_compare;
+
+	// subproblems smaller than this stay on the calling thread
+	static const std::size_t parallel_grain = 1 << 14;
+
+	// a node and its treap, end() has no node
+	class iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef _Key value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const _Key* pointer;
+		typedef const _Key& reference;
+
+		iterator() : tree(NULL), pnode(NULL) { }
+		bool operator==(const iterator& other) const { return pnode == other.pnode; }
+		bool operator!=(const iterator& other) const { return pnode != other.pnode; }
+		iterator& operator++() {
+			if (pnode->right) {
+				pnode = left_most(pnode->right);
+			} else {
+				node* n = pnode;
+				pnode = n->parent;
+				while (pnode && n == pnode->right) {
+					n = pnode;
+					pnode = n->parent;
+				}
+			}
+			return *this;
+		}
+		iterator& operator--() {
+			if (pnode == NULL) {
+				pnode = right_most(tree->m_root); // end() - 1
+			} else if (pnode->left) {
+				pnode = right_most(pnode->left);
+			} else {
+				node* n = pnode;
+				pnode = n->parent;
+				while (pnode && n == pnode->left) {
+					n = pnode;
+					pnode = n->parent;
+				}
+			}
+			return *this;
+		}
+		iterator operator++(int) { iterator tmp(*this); ++*this; return tmp; }
+		iterator operator--(int) { iterator tmp(*this); --*this; return tmp; }
+		reference operator*() const { return key(pnode); }
+		pointer operator->() const { return &key(pnode); }
+	private:
+		friend class treap;
+		iterator(const treap* _tree, node* _pnode) : tree(_tree), pnode(_pnode) { }
+		const treap* tree;
+		node* pnode;
+	};
+
+	typedef iterator const_iterator;
+	typedef std::reverse_iterator<iterator> reverse_iterator;
+	typedef reverse_iterator const_reverse_iterator;
+
+	explicit treap(const _Compare& comp = _Compare())
+		: m_root(NULL), m_seed(0x9e3779b9u), m_comp(comp) { }
+
+	// deep copy, same shape and priorities
+	treap(const treap& other)
+		: m_root(NULL), m_seed(other.m_seed), m_comp(other.m_comp), node_alloc(other.node_alloc) {
+		m_root = clone(other.m_root, NULL);
+	}
+
+	~treap() { clear(); }
+
+	treap& operator=(const treap& other) {
+		if (this != &other) {
+			treap tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+#if __cplusplus >= 201103L
+	treap(treap&& other) : m_root(NULL), m_seed(other.m_seed), m_comp(other.m_comp) {
+		swap(other);
+	}
+
+	treap& operator=(treap&& other) {
+		if (this != &other) {
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+#endif
+
+	void swap(treap& other) {
+		using std::swap;
+		swap(m_root, other.m_root);
+		swap(m_seed, other.m_seed);
+		swap(m_comp, other.m_comp);
+		swap(node_alloc, other.node_alloc);
+	}
+
+	size_t size() const { return size(m_root); }
+
+	bool empty() const { return m_root == NULL; }
+
+	key_compare key_comp() const { return m_comp; }
+
+	void clear() {
+		destroy_tree(m_root);
+		m_root = NULL;
+	}
+
+	std::pair<iterator, bool> insert(const_reference x) {
+		node* n = find_node(x);
+		if (n)
+			return std::make_pair(iterator(this, n), false);
+		return std::make_pair(iterator(this, insert_node(create_node(x))), true);
+	}
+
+#if __cplusplus >= 201103L
+	std::pair<iterator, bool> insert(value_type&& x) {
+		node* n = find_node(x);
+		if (n)
+			return std::make_pair(iterator(this, n), false);
+		return std::make_pair(iterator(this, insert_node(create_node(std::move(x)))), true);
+	}
+
+	template <typename... _Args>
+	std::pair<iterator, bool> emplace(_Args&&... args) {
+		node* n = create_node(std::forward<_Args>(args)...);
+		node* dup = find_node(key(n));
+		if (dup) {
+			free_node(n);
+			return std::make_pair(iterator(this, dup), false);
+		}
+		return std::make_pair(iterator(this, insert_node(n)), true);
+	}
+#endif
+
+	template <typename _InputIterator>
+	void insert(_InputIterator first, _InputIterator last) {
+		for (; first != last; ++first)
+			insert(*first);
+	}
+
+	size_t erase(const_reference x) {
+		node* n = find_node(x);
+		if (!n)
+			return 0;
+		node* p = n->parent;
+		node* kid = join_nodes(n->left, n->right);
+		replace_kid(p, n, kid);
+		for (; p; p = p->parent)
+			--p->size;
+		free_node(n);
+		return 1;
+	}
+
+	/* keys not less than x move to right, which loses what it had.
+	 O(log n) expected */
+	void split(const_reference x, treap& right) {
+		right.clear();
+		node* l;
+		node* r;
+		split_nodes(m_root, x, l, r);
+		set_root(l);
+		right.set_root(r);
+	}
+
+	/* moves every key of right to the end, they must all be greater than
+	 ours. O(log n) expected */
+	void join(treap& right) {
+		set_root(join_nodes(m_root, right.m_root));
+		right.m_root = NULL;
+	}
+
+	// keys of either, other ends up empty
+	void unite(treap& other) { set_operation(&treap::union_nodes, other); }
+
+	// keys of both, other ends up empty
+	void intersect(treap& other) { set_operation(&treap::intersect_nodes, other); }
+
+	// our keys that are not in other, other ends up empty
+	void subtract(treap& other) { set_operation(&treap::subtract_nodes, other); }
+
+	size_t count(const_reference x) const { return find_node(x) ? 1 : 0; }
+
+	iterator find(const_reference x) const { return iterator(this, find_node(x)); }
+
+	// first key not less than x
+	iterator lower_bound(const_reference x) const {
+		node* n = m_root;
+		node* ge = NULL;
+		while (n) {
+			if (m_comp(key(n), x)) {
+				n = n->right;
+			} else {
+				ge = n;
+				n = n->left;
+			}
+		}
+		return iterator(this, ge);
+	}
+
+	// first key greater than x
+	iterator upper_bound(const_reference x) const {
+		node* n = m_root;
+		node* gt = NULL;
+		while (n) {
+			if (m_comp(x, key(n))) {
+				gt = n;
+				n = n->left;
+			} else {
+				n = n->right;
+			}
+		}
+		return iterator(this, gt);
+	}
+
+	iterator begin() const { return iterator(this, m_root ? left_most(m_root) : NULL); }
+	iterator end() const { return iterator(this, NULL); }
+	reverse_iterator rbegin() const { return reverse_iterator(end()); }
+	reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+	const_reference min() const { return key(left_most(m_root)); }
+	const_reference max() const { return key(right_most(m_root)); }
+
+private:
+	node* m_root;
+	unsigned m_seed; // xorshift state for the priorities
+	_Compare m_comp;
+
+	typedef typename _Alloc::template rebind<node>::other node_allocator;
+	node_allocator node_alloc;
+
+	// subtrees left over by the set operations, freed once they are done
+	typedef std::vector<node*> garbage;
+	typedef node* (treap::*set_op)(node*, node*, int, garbage&);
+
+	unsigned next_priority() {
+		m_seed ^= m_seed << 13;
+		m_seed ^= m_seed >> 17;
+		m_seed ^= m_seed << 5;
+		return m_seed;
+	}
+
+	void set_root(node* n) {
+		m_root = n;
+		if (n)
+			n->parent = NULL;
+	}
+
+	// links the kids and recomputes the size
+	static node* set_kids(node* n, node* l, node* r) {
+		n->left = l;
+		n->right = r;
+		if (l)
+			l->parent = n;
+		if (r)
+			r->parent = n;
+		n->size = 1 + size(l) + size(r);
+		return n;
+	}
+
+	void replace_kid(node* p, node* old_kid, node* new_kid) {
+		if (new_kid)
+			new_kid->parent = p;
+		if (!p)
+			m_root = new_kid;
+		else if (p->left == old_kid)
+			p->left = new_kid;
+		else
+			p->right = new_kid;
+	}
+
+	// t into keys less than x (l) and the rest (r)
+	void split_nodes(node* t, const_reference x, node*& l, node*& r) const {
+		if (!t) {
+			l = r = NULL;
+		} else if (m_comp(key(t), x)) {
+			node* rl;
+			split_nodes(t->right, x, rl, r);
+			l = set_kids(t, t->left, rl);
+		} else {
+			node* lr;
+			split_nodes(t->left, x, l, lr);
+			r = set_kids(t, lr, t->right);
+		}
+	}
+
+	// like split_nodes but takes a node equal to x out into mid
+	void split_nodes(node* t, const_reference x, node*& l, node*& mid, node*& r) const {
+		if (!t) {
+			l = mid = r = NULL;
+		} else if (m_comp(key(t), x)) {
+			node* rl;
+			split_nodes(t->right, x, rl, mid, r);
+			l = set_kids(t, t->left, rl);
+		} else if (m_comp(x, key(t))) {
+			node* lr;
+			split_nodes(t->left, x, l, mid, lr);
+			r = set_kids(t, lr, t->right);
+		} else {
+			l = t->left;
+			r = t->right;
+			mid = set_kids(t, NULL, NULL);
+		}
+	}
+
+	// every key of l is less than every key of r
+	static node* join_nodes(node* l, node* r) {
+		if (!l)
+			return r;
+		if (!r)
+			return l;
+		if (l->priority > r->priority)
+			return set_kids(l, l->left, join_nodes(l->right, r));
+		return set_kids(r, join_nodes(l, r->left), r->right);
+	}
+
+	// descends to where n's priority fits, splits that subtree around n
+	node* insert_node(node* n) {
+		node* p = NULL;
+		node* t = m_root;
+		bool left = false;
+		while (t && t->priority >= n->priority) {
+			++t->size;
+			p = t;
+			left = m_comp(key(n), key(t));
+			t = left ? t->left : t->right;
+		}
+		node* l;
+		node* r;
+		split_nodes(t, key(n), l, r);
+		set_kids(n, l, r);
+		n->parent = p;
+		if (!p)
+			m_root = n;
+		else if (left)
+			p->left = n;
+		else
+			p->right = n;
+		return n;
+	}
+
+	void set_operation(set_op op, treap& other) {
+		garbage g;
+		set_root((this->*op)(m_root, other.m_root, fork_depth(), g));
+		other.m_root = NULL;
+		for (typename garbage::iterator it = g.begin(); it != g.end(); ++it)
+			destroy_tree(*it);
+	}
+
+	// both halves of a set operation, forked while there are threads to use
+	void run_both(set_op op, node* a1, node* b1, node*& r1, node* a2, node* b2, node*& r2,
+			int depth, garbage& g) {
+#if __cplusplus >= 201103L
+		if (depth > 0 && size(a1) + size(b1) + size(a2) + size(b2) >= parallel_grain) {
+			garbage g1;
+			std::future<node*> f = std::async(std::launch::async, op, this, a1, b1, depth - 1, std::ref(g1));
+			r2 = (this->*op)(a2, b2, depth - 1, g);
+			r1 = f.get();
+			g.insert(g.end(), g1.begin(), g1.end());
+			return;
+		}
+#endif
+		r1 = (this->*op)(a1, b1, depth, g);
+		r2 = (this->*op)(a2, b2, depth, g);
+	}
+
+	// forks deep enough for about twice as many tasks as cores
+	static int fork_depth() {
+#if __cplusplus >= 201103L
+		int depth = 1;
+		for (unsigned tasks = std::thread::hardware_concurrency(); tasks > 1; tasks >>= 1)
+			++depth;
+		return depth;
+#else
+		return 0;
+#endif
+	}
+
+	/* the root with the higher priority stays on top, the other treap is
+	 split around it and each side merged with the matching subtree */
+	node* union_nodes(node* a, node* b, int depth, garbage& g) {
+		if (!a)
+			return b;
+		if (!b)
+			return a;
+		if (a->priority < b->priority)
+			std::swap(a, b);
+		node* l;
+		node* dup;
+		node* r;
+		split_nodes(b, key(a), l, dup, r);
+		if (dup)
+			g.push_back(dup);
+		node* nl;
+		node* nr;
+		run_both(&treap::union_nodes, a->left, l, nl, a->right, r, nr, depth, g);
+		return set_kids(a, nl, nr);
+	}
+
+	node* intersect_nodes(node* a, node* b, int depth, garbage& g) {
+		if (!a || !b) {
+			g.push_back(a ? a : b);
+			return NULL;
+		}
+		node* l;
+		node* dup;
+		node* r;
+		split_nodes(b, key(a), l, dup, r);
+		node* nl;
+		node* nr;
+		run_both(&treap::intersect_nodes, a->left, l, nl, a->right, r, nr, depth, g);
+		if (dup) {
+			g.push_back(dup);
+			return set_kids(a, nl, nr);
+		}
+		g.push_back(set_kids(a, NULL, NULL));
+		return join_nodes(nl, nr);
+	}
+
+	node* subtract_nodes(node* a, node* b, int depth, garbage& g) {
+		if (!a || !b) {
+			if (b)
+				g.push_back(b);
+			return a;
+		}
+		node* l;
+		node* dup;
+		node* r;
+		split_nodes(b, key(a), l, dup, r);
+		node* nl;
+		node* nr;
+		run_both(&treap::subtract_nodes, a->left, l, nl, a->right, r, nr, depth, g);
+		if (dup) {
+			g.push_back(dup);
+			g.push_back(set_kids(a, NULL, NULL));
+			return join_nodes(nl, nr);
+		}
+		return set_kids(a, nl, nr);
+	}
+
+	node* clone(const node* n, node* parent) {
+		if (!n)
+			return NULL;
+		node* c = create_node(key(n));
+		c->priority = n->priority;
+		c->size = n->size;
+		c->parent = parent;
+		try {
+			c->left = clone(n->left, c);
+			c->right = clone(n->right, c);
+		} catch (...) {
+			destroy_tree(c);
+			throw;
+		}
+		return c;
+	}
+
+	void destroy_tree(node* n) {
+		while (n) {
+			destroy_tree(n->left);
+			node* r = n->right;
+			free_node(n);
+			n = r;
+		}
+	}
+
+	void free_node(node* pnode) {
+#if __cplusplus >= 201103L
+		std::allocator_traits<node_allocator>::destroy(node_alloc, &pnode->data);
+#else
+		pnode->data.~_Key();
+#endif
+		node_alloc.deallocate(pnode, 1);
+	}
+
+	// allocates a new unlinked node with a fresh priority and constructs its key
+#if __cplusplus >= 201103L
+	template <typename... _Args>
+	node* create_node(_Args&&... args) {
+		node* nn = node_alloc.allocate(1);
+		try {
+			std::allocator_traits<node_allocator>::construct(node_alloc, &nn->data, std::forward<_Args>(args)...);
+		} catch (...) {
+			node_alloc.deallocate(nn, 1);
+			throw;
+		}
+		return init_node(nn);
+	}
+#else
+	node* create_node(const_reference x) {
+		node* nn = node_alloc.allocate(1);
+		try {
+			::new (static_cast<void*>(&nn->data)) _Key(x);
+		} catch (...) {
+			node_alloc.deallocate(nn, 1);
+			throw;
+		}
+		return init_node(nn);
+	}
+#endif
+
+	node* init_node(node* nn) {
+		nn->parent = nn->left = nn->right = NULL;
+		nn->priority = next_priority();
+		nn->size = 1;
+		return nn;
+	}
+
+	node* find_node(const_reference x) const {
+		node* ge = lower_bound(x).pnode;
+		return (ge && !m_comp(x, key(ge))) ? ge : NULL;
+	}
+};
+
+template <typename _Key, typename _Compare, typename _Alloc>
+inline void swap(treap<_Key, _Compare, _Alloc>& a, treap<_Key, _Compare, _Alloc>& b) {
+	a.swap(b);
+}
+
+}; // namespace
+
+#endif /* TREAP_H_ */